@@ -0,0 +1,208 @@
+/* aggregate.c - reduce the sensor samples to one temperature
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Averaging every sensor dilutes a hot CPU die with cool palm rest and
+ * ambient sensors. These strategies work on the contiguous sample array
+ * of the sensor table and never allocate.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aggregate.h"
+
+static const char *method_names[] = {
+	[AGGREGATE_MEAN]       = "mean",
+	[AGGREGATE_MAX]        = "max",
+	[AGGREGATE_WEIGHTED]   = "weighted",
+	[AGGREGATE_TOP_K]      = "top_k",
+	[AGGREGATE_PERCENTILE] = "percentile",
+};
+
+void aggregation_init(t_aggregation *agg) {
+	unsigned int i;
+
+	agg->method        = AGGREGATE_MEAN;
+	agg->k             = 1;
+	agg->percentile    = 100;
+	agg->weights_count = 0;
+
+	for (i = 0; i < SENSORS_MAX; i++) {
+		agg->weight[i] = 1;
+	}
+}
+
+int aggregation_parse_method(const char *name, enum aggregation_method *method) {
+	unsigned int i;
+
+	for (i = 0; i < sizeof(method_names) / sizeof(method_names[0]); i++) {
+		if (strcmp(name, method_names[i]) == 0) {
+			*method = (enum aggregation_method) i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+const char *aggregation_method_name(enum aggregation_method method) {
+	return method_names[method];
+}
+
+unsigned int aggregation_parse_weights(t_aggregation *agg, const char *spec) {
+	char label[LABEL_LEN];
+	int weight;
+	int consumed;
+
+	agg->weights_count = 0;
+
+	while (*spec != '\0' && agg->weights_count < AGGREGATION_WEIGHTS_MAX) {
+		while (*spec == ',' || isspace((unsigned char) *spec)) {
+			spec++;
+		}
+
+		if (sscanf(spec, " %15[^:, ] : %d%n", label, &weight, &consumed) != 2) {
+			break;
+		}
+
+		strcpy(agg->weight_label[agg->weights_count], label);
+		agg->weight_value[agg->weights_count] = weight < 0 ? 0 : weight;
+		agg->weights_count++;
+
+		spec += consumed;
+	}
+
+	return agg->weights_count;
+}
+
+int aggregation_weight(const t_aggregation *agg, const char *label) {
+	unsigned int j;
+
+	for (j = 0; j < agg->weights_count; j++) {
+		if (strcmp(label, agg->weight_label[j]) == 0) {
+			return agg->weight_value[j];
+		}
+	}
+
+	return 1;
+}
+
+void aggregation_bind(t_aggregation *agg, const t_sensors *sensors) {
+	unsigned int i;
+
+	for (i = 0; i < sensors->count; i++) {
+		agg->weight[i] = aggregation_weight(agg, sensors->label[i]);
+	}
+}
+
+static void swap(int *values, int a, int b) {
+	int tmp = values[a];
+	values[a] = values[b];
+	values[b] = tmp;
+}
+
+/* Partially order values so that values[nth] is what a full sort would put
+ * there, with nothing greater before it and nothing smaller after it */
+static void select_nth(int *values, int count, int nth) {
+	int left  = 0;
+	int right = count - 1;
+
+	while (left < right) {
+		int store = left;
+		int i;
+
+		swap(values, (left + right) / 2, right);
+
+		for (i = left; i < right; i++) {
+			if (values[i] < values[right]) {
+				swap(values, i, store++);
+			}
+		}
+
+		swap(values, store, right);
+
+		if (nth == store) {
+			return;
+		}
+		else if (nth < store) {
+			right = store - 1;
+		}
+		else {
+			left = store + 1;
+		}
+	}
+}
+
+int aggregate_temp(const t_aggregation *agg, const int *samples, unsigned int count) {
+	int scratch[SENSORS_MAX];
+	long long sum = 0;
+	long long weights = 0;
+	unsigned int i;
+	unsigned int first;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	switch (agg->method) {
+		case AGGREGATE_MAX: {
+			int hottest = samples[0];
+
+			for (i = 1; i < count; i++) {
+				hottest = samples[i] > hottest ? samples[i] : hottest;
+			}
+
+			return hottest;
+		}
+
+		case AGGREGATE_WEIGHTED:
+			for (i = 0; i < count; i++) {
+				sum     += (long long) agg->weight[i] * samples[i];
+				weights += agg->weight[i];
+			}
+
+			// Every sensor weighs 0: nothing sensible to do but average
+			if (weights != 0) {
+				return (int)(sum / weights);
+			}
+
+			break;
+
+		case AGGREGATE_TOP_K:
+			if (agg->k >= count) {
+				break;
+			}
+
+			memcpy(scratch, samples, count * sizeof(int));
+			first = count - agg->k;
+			select_nth(scratch, (int) count, (int) first);
+
+			for (i = first; i < count; i++) {
+				sum += scratch[i];
+			}
+
+			return (int)(sum / agg->k);
+
+		case AGGREGATE_PERCENTILE:
+			memcpy(scratch, samples, count * sizeof(int));
+
+			// Nearest rank: the smallest sample at or above the percentile
+			first = (agg->percentile * count + 99) / 100;
+			first = first == 0 ? 0 : first - 1;
+			select_nth(scratch, (int) count, (int) first);
+
+			return scratch[first];
+
+		case AGGREGATE_MEAN:
+			break;
+	}
+
+	for (i = 0; i < count; i++) {
+		sum += samples[i];
+	}
+
+	return (int)(sum / count);
+}
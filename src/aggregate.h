@@ -0,0 +1,94 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _AGGREGATE_H_
+#define _AGGREGATE_H_
+
+#include "global.h"
+
+/** How the samples of all sensors are reduced to one temperature
+ *  mean       - arithmetic mean of every sensor (the historical behaviour)
+ *  max        - hottest sensor
+ *  weighted   - mean weighted per sensor label, see sensor_weights
+ *  top_k      - mean of the k hottest sensors
+ *  percentile - nearest-rank percentile of the samples
+ */
+enum aggregation_method {
+	AGGREGATE_MEAN,
+	AGGREGATE_MAX,
+	AGGREGATE_WEIGHTED,
+	AGGREGATE_TOP_K,
+	AGGREGATE_PERCENTILE,
+};
+
+#define AGGREGATION_WEIGHTS_MAX 16
+
+struct s_aggregation {
+	enum aggregation_method method;
+
+	unsigned int k;           // for top_k
+	unsigned int percentile;  // for percentile, 1 to 100
+
+	/* label:weight pairs as configured, unlisted sensors weigh 1 */
+	unsigned int weights_count;
+	char         weight_label[AGGREGATION_WEIGHTS_MAX][LABEL_LEN];
+	int          weight_value[AGGREGATION_WEIGHTS_MAX];
+
+	/* weights resolved per sensor by aggregation_bind() */
+	int          weight[SENSORS_MAX];
+};
+
+typedef struct s_aggregation t_aggregation;
+
+/**
+ * Reset to the arithmetic mean of every sensor
+ */
+void aggregation_init(t_aggregation *agg);
+
+/**
+ * Look up a method by its configuration name
+ * Return TRUE on success
+ * Return FALSE for an unknown name, method is left untouched
+ */
+int aggregation_parse_method(const char *name, enum aggregation_method *method);
+
+/**
+ * Return the configuration name of a method
+ */
+const char *aggregation_method_name(enum aggregation_method method);
+
+/**
+ * Parse a list of label:weight pairs such as "TC0P:4, TC0D:2"
+ * Return the number of pairs stored
+ */
+unsigned int aggregation_parse_weights(t_aggregation *agg, const char *spec);
+
+/**
+ * Return the configured weight of a sensor label, 1 if it is not listed
+ */
+int aggregation_weight(const t_aggregation *agg, const char *label);
+
+/**
+ * Resolve the configured weights against a table of sensors
+ * Must be called again whenever the sensors or the weights change
+ */
+void aggregation_bind(t_aggregation *agg, const t_sensors *sensors);
+
+/**
+ * Reduce count samples, in millidegrees, to one temperature in millidegrees
+ */
+int aggregate_temp(const t_aggregation *agg, const int *samples, unsigned int count);
+
+#endif
@@ -0,0 +1,341 @@
+/* autotune.c - thermal step response tuning
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * The fans are settled at one speed and stepped to another while the
+ * temperature is recorded. A first order plus dead time model is fitted
+ * to the response with the two point method (28.3% and 63.2% of the
+ * final change), and PI gains follow from it by the SIMC rules.
+ *
+ * The plant is a set of callbacks, so the tests run the whole experiment
+ * against a simulation instead of the SMC.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include "autotune.h"
+
+static int samples[AUTOTUNE_SAMPLES_MAX];
+
+void autotune_init(t_autotune *at, int min_speed, int max_speed, int abort_temp) {
+	at->speed_high       = max_speed;
+	at->speed_low        = min_speed;
+	at->sample_ms        = 1000;
+	at->settle_ms        = 60000;
+	at->settle_tolerance = 250;
+	at->timeout_ms       = 900000;
+	at->abort_temp       = abort_temp;
+}
+
+/* Sample the plant until it settles
+ * Return 0 once settled, -ETIMEDOUT or -ERANGE otherwise
+ */
+static int record(const t_autotune *at, const t_autotune_plant *plant, unsigned int *count) {
+	unsigned int window = at->settle_ms / at->sample_ms > 0 ? (unsigned int)(at->settle_ms / at->sample_ms) : 1;
+	unsigned int limit  = (unsigned int)(at->timeout_ms / at->sample_ms) + 1;
+
+	if (limit > AUTOTUNE_SAMPLES_MAX) {
+		limit = AUTOTUNE_SAMPLES_MAX;
+	}
+
+	*count = 0;
+	samples[(*count)++] = plant->read_temp(plant->ctx);
+
+	while (1) {
+		int last = samples[*count - 1];
+
+		if (last >= at->abort_temp) {
+			return -ERANGE;
+		}
+
+		if (*count > window && abs(last - samples[*count - 1 - window]) <= at->settle_tolerance) {
+			return 0;
+		}
+
+		if (*count >= limit) {
+			return -ETIMEDOUT;
+		}
+
+		plant->wait(plant->ctx, at->sample_ms);
+		samples[(*count)++] = plant->read_temp(plant->ctx);
+	}
+}
+
+int autotune_run(const t_autotune *at, const t_autotune_plant *plant, t_autotune_model *model) {
+	unsigned int count = 0;
+	int result;
+
+	printf("Settling at %d RPM\n", at->speed_high);
+	plant->set_speed(plant->ctx, at->speed_high);
+	result = record(at, plant, &count);
+
+	if (result == 0) {
+		printf("Settled at %d millidegrees after %u s, stepping to %d RPM\n", samples[count - 1], (count - 1) * at->sample_ms / 1000, at->speed_low);
+		plant->set_speed(plant->ctx, at->speed_low);
+		result = record(at, plant, &count);
+	}
+
+	if (result == 0) {
+		printf("Settled at %d millidegrees after %u s\n", samples[count - 1], (count - 1) * at->sample_ms / 1000);
+		result = autotune_fit(samples, count, at->sample_ms, at->speed_low - at->speed_high, model);
+	}
+
+	// Leave the machine cool whatever happened
+	plant->set_speed(plant->ctx, at->speed_high);
+	return result;
+}
+
+/* Seconds until the response first covers fraction of its change */
+static double crossing(const int *samples, unsigned int count, int sample_ms, double fraction) {
+	double start = samples[0];
+	double delta = samples[count - 1] - start;
+	unsigned int i;
+
+	for (i = 1; i < count; i++) {
+		if ((samples[i] - start) / delta >= fraction) {
+			double previous = (samples[i - 1] - start) / delta;
+			double current  = (samples[i] - start) / delta;
+
+			return (i - 1 + (fraction - previous) / (current - previous)) * sample_ms / 1000.0;
+		}
+	}
+
+	return (count - 1) * sample_ms / 1000.0;
+}
+
+int autotune_fit(const int *samples, unsigned int count, int sample_ms, int speed_change, t_autotune_model *model) {
+	if (count < 3 || speed_change == 0 || abs(samples[count - 1] - samples[0]) < 1000) {
+		return -ERANGE;
+	}
+
+	double t28 = crossing(samples, count, sample_ms, 0.283);
+	double t63 = crossing(samples, count, sample_ms, 0.632);
+
+	model->tau         = 1.5 * (t63 - t28);
+	model->dead_time   = t63 - model->tau > 0 ? t63 - model->tau : 0;
+	model->gain        = (samples[count - 1] - samples[0]) / 1000.0 / speed_change;
+	model->temp_before = samples[0];
+	model->temp_after  = samples[count - 1];
+
+	return model->tau > 0 ? 0 : -ERANGE;
+}
+
+void autotune_pid(const t_autotune_model *model, double *kp, double *ki, double *kd) {
+	double gain = fabs(model->gain);
+
+	// Closed loop as fast as the dead time allows, and no faster than a quarter of the lag
+	double tau_c = model->dead_time > model->tau / 4 ? model->dead_time : model->tau / 4;
+	double t_i   = 4 * (tau_c + model->dead_time) < model->tau ? 4 * (tau_c + model->dead_time) : model->tau;
+
+	*kp = model->tau / (gain * (tau_c + model->dead_time));
+	*ki = *kp / t_i;
+	*kd = 0;
+}
+
+/* A setting autotune_save() writes */
+struct s_tuned_key {
+	const char *section;
+	const char *key;
+	char value[32];
+	int present;  // already set in the file
+	int seen;     // its section is in the file
+};
+
+/* Copy the name of the section a line opens into name
+ * Return TRUE if the line opens one
+ */
+static int line_section(const char *line, char *name, size_t n_name) {
+	const char *start = line + strspn(line, " \t");
+
+	if (*start != '[') {
+		return 0;
+	}
+
+	start++;
+	size_t length = strcspn(start, "]");
+
+	if (start[length] != ']' || length >= n_name) {
+		return 0;
+	}
+
+	memcpy(name, start, length);
+	name[length] = '\0';
+	return 1;
+}
+
+/* Return the offset of the value when the line sets key, 0 otherwise */
+static size_t line_value(const char *line, const char *key) {
+	const char *start = line + strspn(line, " \t");
+	size_t length = strlen(key);
+
+	if (strncmp(start, key, length) != 0) {
+		return 0;
+	}
+
+	start += length;
+	start += strspn(start, " \t");
+
+	if (*start != '=') {
+		return 0;
+	}
+
+	start++;
+	start += strspn(start, " \t");
+	return (size_t)(start - line);
+}
+
+/* Write line with the value at offset replaced, keeping its comment in place */
+static void write_value(FILE *out, const char *line, size_t offset, const char *value) {
+	const char *comment = strchr(line + offset, '#');
+
+	fwrite(line, 1, offset, out);
+
+	if (comment == NULL) {
+		fprintf(out, "%s\n", value);
+		return;
+	}
+
+	int width = (int)(comment - (line + offset)) - 1;
+	fprintf(out, "%-*s %s", width > 0 ? width : 0, value, comment);
+}
+
+/* Write the keys of section the file does not set yet */
+static void write_missing(FILE *out, struct s_tuned_key *keys, size_t n_keys, const char *section) {
+	size_t i;
+
+	for (i = 0; i < n_keys; i++) {
+		if (!keys[i].present && strcmp(keys[i].section, section) == 0) {
+			fprintf(out, "%s = %s\n", keys[i].key, keys[i].value);
+			keys[i].present = 1;
+		}
+	}
+}
+
+int autotune_save(const char *path, const t_autotune_model *model, double kp, double ki, double kd) {
+	char tmp_path[PATH_MAX];
+	char bak_path[PATH_MAX];
+	char section[64] = "";
+	char *line = NULL;
+	size_t n_line = 0;
+	size_t i;
+	struct s_tuned_key keys[] = {
+		{ "general",  "control_mode",  "pid", 0, 0 },
+		{ "general",  "pid_kp",        "",    0, 0 },
+		{ "general",  "pid_ki",        "",    0, 0 },
+		{ "general",  "pid_kd",        "",    0, 0 },
+		{ "autotune", "gain",          "",    0, 0 },
+		{ "autotune", "time_constant", "",    0, 0 },
+		{ "autotune", "dead_time",     "",    0, 0 },
+	};
+	size_t n_keys = sizeof(keys) / sizeof(keys[0]);
+
+	snprintf(keys[1].value, sizeof(keys[1].value), "%.1f", kp);
+	snprintf(keys[2].value, sizeof(keys[2].value), "%.3f", ki);
+	snprintf(keys[3].value, sizeof(keys[3].value), "%.1f", kd);
+	snprintf(keys[4].value, sizeof(keys[4].value), "%.6f", model->gain);
+	snprintf(keys[5].value, sizeof(keys[5].value), "%.1f", model->tau);
+	snprintf(keys[6].value, sizeof(keys[6].value), "%.1f", model->dead_time);
+
+	// Only the tuned values change, every other line and comment is kept as is
+	FILE *in = fopen(path, "r");
+
+	while (in != NULL && getline(&line, &n_line, in) != -1) {
+		if (line_section(line, section, sizeof(section))) {
+			for (i = 0; i < n_keys; i++) {
+				keys[i].seen |= strcmp(keys[i].section, section) == 0;
+			}
+
+			continue;
+		}
+
+		for (i = 0; i < n_keys; i++) {
+			if (strcmp(keys[i].section, section) == 0 && line_value(line, keys[i].key) != 0) {
+				keys[i].present = 1;
+			}
+		}
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	snprintf(bak_path, sizeof(bak_path), "%s.bak", path);
+
+	FILE *file = fopen(tmp_path, "w");
+
+	if (file == NULL) {
+		int error = errno;
+		free(line);
+
+		if (in != NULL) {
+			fclose(in);
+		}
+
+		return -error;
+	}
+
+	if (in != NULL) {
+		rewind(in);
+		section[0] = '\0';
+
+		while (getline(&line, &n_line, in) != -1) {
+			size_t offset = 0;
+
+			if (line_section(line, section, sizeof(section))) {
+				fputs(line, file);
+				write_missing(file, keys, n_keys, section);
+				continue;
+			}
+
+			for (i = 0; i < n_keys && offset == 0; i++) {
+				if (strcmp(keys[i].section, section) == 0) {
+					offset = line_value(line, keys[i].key);
+				}
+			}
+
+			if (offset != 0) {
+				write_value(file, line, offset, keys[i - 1].value);
+			}
+			else {
+				fputs(line, file);
+			}
+		}
+
+		fclose(in);
+	}
+
+	free(line);
+
+	// Sections the file has none of go at its end
+	for (i = 0; i < n_keys; i++) {
+		if (!keys[i].seen && !keys[i].present) {
+			fprintf(file, "\n[%s]\n", keys[i].section);
+			write_missing(file, keys, n_keys, keys[i].section);
+		}
+	}
+
+	int failed = ferror(file);
+
+	if (fclose(file) != 0 || failed) {
+		unlink(tmp_path);
+		return -EIO;
+	}
+
+	// The new file replaces the old one atomically, a hard link keeps the old one
+	unlink(bak_path);
+
+	if (link(path, bak_path) != 0 && errno != ENOENT) {
+		printf("Could not keep a copy of %s: %s\n", path, strerror(errno));
+	}
+
+	if (rename(tmp_path, path) != 0) {
+		int error = errno;
+		unlink(tmp_path);
+		return -error;
+	}
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+/** Upper bound for the samples recorded by one step
+ */
+#define AUTOTUNE_SAMPLES_MAX 4096
+
+/** What the experiment acts on: the fans and sensors, or a simulation
+ *  set_speed - set every fan, in RPM
+ *  read_temp - return the temperature, in millidegrees
+ *  wait      - let ms milliseconds pass
+ */
+struct s_autotune_plant {
+	void (*set_speed)(void *ctx, int speed);
+	int  (*read_temp)(void *ctx);
+	void (*wait)(void *ctx, int ms);
+	void *ctx;
+};
+
+typedef struct s_autotune_plant t_autotune_plant;
+
+/** The step experiment
+ *  speed_high, speed_low - fan speeds before and after the step
+ *  sample_ms             - time between two samples
+ *  settle_ms, settle_tolerance - settled once the temperature moved less
+ *                          than settle_tolerance millidegrees in settle_ms
+ *  timeout_ms            - longest wait for each phase to settle
+ *  abort_temp            - millidegrees at which the step is called off
+ */
+struct s_autotune {
+	int speed_high;
+	int speed_low;
+	int sample_ms;
+	int settle_ms;
+	int settle_tolerance;
+	int timeout_ms;
+	int abort_temp;
+};
+
+typedef struct s_autotune t_autotune;
+
+/** First order plus dead time model of the temperature response
+ *  gain      - degrees per RPM, negative as faster fans cool
+ *  tau       - time constant, seconds
+ *  dead_time - seconds before the temperature starts to move
+ */
+struct s_autotune_model {
+	double gain;
+	double tau;
+	double dead_time;
+
+	int temp_before;  // settled at speed_high, millidegrees
+	int temp_after;   // settled at speed_low, millidegrees
+};
+
+typedef struct s_autotune_model t_autotune_model;
+
+/**
+ * Defaults for an experiment between min_speed and max_speed
+ */
+void autotune_init(t_autotune *at, int min_speed, int max_speed, int abort_temp);
+
+/**
+ * Settle the plant at speed_high, step it to speed_low, record the
+ * response and fit a model to it; the plant is left at speed_high
+ * Return 0 on success
+ * Return a negative errno otherwise: -ETIMEDOUT if the plant did not
+ * settle, -ERANGE if it reached abort_temp or barely responded
+ */
+int autotune_run(const t_autotune *at, const t_autotune_plant *plant, t_autotune_model *model);
+
+/**
+ * Fit a model to count samples, sample_ms apart, starting at a step
+ * of the fan speed by speed_change RPM
+ * Return 0 on success
+ * Return -ERANGE if the temperature did not move enough
+ */
+int autotune_fit(const int *samples, unsigned int count, int sample_ms, int speed_change, t_autotune_model *model);
+
+/**
+ * PI gains for the pid control mode from a model (SIMC rules), in the
+ * units of pid_kp, pid_ki and pid_kd
+ */
+void autotune_pid(const t_autotune_model *model, double *kp, double *ki, double *kd);
+
+/**
+ * Write the gains and the model into the settings file at path, in
+ * place of their current values and keeping every other line and
+ * comment, and keep a copy of the previous file as path.bak
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int autotune_save(const char *path, const t_autotune_model *model, double kp, double ki, double kd);
+
+#endif
@@ -0,0 +1,321 @@
+/* control.c - the local control socket
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Requests and replies are single datagrams of text, so serving them
+ * keeps no per client state and never blocks the control loop: a
+ * client that does not read its reply only loses it. Replies start
+ * with "ok" or "error", and multi line replies give their line count:
+ *
+ *   state                    ok temp=51250 speed=2400 override=0 ...
+ *   sensors                  ok 2\nTC0P 51250 0\ntemp2 49000 0
+ *   fans                     ok 1\nfan1 2400 2390
+ *   metrics                  ok\n followed by the Prometheus text format
+ *   override SPEED SECONDS   ok, fans held at SPEED for SECONDS
+ *   override off             ok, fans follow the controller again
+ *   profile PATH             ok, settings of PATH loaded
+ *
+ * The kernel attaches the credentials of the sender to each request,
+ * so the socket is world writable but only root changes anything.
+ */
+
+// struct ucred and SCM_CREDENTIALS
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "global.h"
+#include "control.h"
+#include "metrics.h"
+
+/* Append to the reply, silently truncated at its end */
+static void reply_append(t_control *control, size_t *length, const char *format, ...) {
+	va_list args;
+
+	if (*length >= sizeof(control->reply) - 1) {
+		return;
+	}
+
+	va_start(args, format);
+	int n = vsnprintf(control->reply + *length, sizeof(control->reply) - *length, format, args);
+	va_end(args);
+
+	if (n > 0) {
+		*length = *length + (size_t) n < sizeof(control->reply) ? *length + (size_t) n : sizeof(control->reply) - 1;
+	}
+}
+
+static size_t reply_error(t_control *control, int error) {
+	size_t length = 0;
+	reply_append(control, &length, "error %s", strerror(-error));
+	return length;
+}
+
+static size_t reply_result(t_control *control, int result) {
+	size_t length = 0;
+
+	if (result != 0) {
+		return reply_error(control, result);
+	}
+
+	reply_append(control, &length, "ok");
+	return length;
+}
+
+size_t control_handle(t_control *control, const char *request, int privileged) {
+	const t_control_state *state = &control->state;
+	char command[16];
+	char argument[PATH_MAX];
+	size_t length = 0;
+	unsigned int i;
+	int speed;
+	int seconds;
+
+	if (sscanf(request, "%15s", command) != 1) {
+		return reply_error(control, -EINVAL);
+	}
+
+	if (strcmp(command, "state") == 0) {
+		reply_append(control, &length, "ok temp=%d speed=%d override=%d override_left=%d interval_ms=%d late_ms=%d ticks=%lu missed=%lu profile=%s",
+			state->temp, state->speed, state->override_speed, state->override_left, state->interval_ms, state->late_ms,
+			state->ticks, state->missed, control->profile != NULL ? control->profile : "");
+	}
+	else if (strcmp(command, "sensors") == 0) {
+		if (sensors == NULL) {
+			return reply_error(control, -ENODEV);
+		}
+
+		reply_append(control, &length, "ok %u", sensors->count);
+
+		for (i = 0; i < sensors->count; i++) {
+			if (sensors->label[i][0] != '\0') {
+				reply_append(control, &length, "\n%s", sensors->label[i]);
+			}
+			else {
+				reply_append(control, &length, "\ntemp%u", sensors->index[i]);
+			}
+
+			reply_append(control, &length, " %d %u", sensors->temperature[i], sensors->read_errors[i]);
+		}
+	}
+	else if (strcmp(command, "fans") == 0) {
+		if (fans == NULL) {
+			return reply_error(control, -ENODEV);
+		}
+
+		reply_append(control, &length, "ok %u", fans->count);
+
+		for (i = 0; i < fans->count; i++) {
+			if (fans->label[i][0] != '\0') {
+				reply_append(control, &length, "\n%s", fans->label[i]);
+			}
+			else {
+				reply_append(control, &length, "\nfan%u", fans->index[i]);
+			}
+
+			reply_append(control, &length, " %d %d", fans->last_written[i], fans->measured[i]);
+		}
+	}
+	else if (strcmp(command, "metrics") == 0) {
+		size_t rendered;
+		const char *text = metrics_render(sensors, fans, &rendered);
+
+		reply_append(control, &length, "ok\n%s", text);
+	}
+	else if (strcmp(command, "override") == 0) {
+		if (!privileged) {
+			return reply_error(control, -EPERM);
+		}
+
+		if (sscanf(request, "%*s %4095s", argument) == 1 && strcmp(argument, "off") == 0) {
+			return reply_result(control, control->ops.override(control->ops.ctx, 0, 0));
+		}
+
+		if (sscanf(request, "%*s %d %d", &speed, &seconds) != 2 || speed < 0 || seconds <= 0) {
+			return reply_error(control, -EINVAL);
+		}
+
+		return reply_result(control, control->ops.override(control->ops.ctx, speed, seconds));
+	}
+	else if (strcmp(command, "profile") == 0) {
+		if (!privileged) {
+			return reply_error(control, -EPERM);
+		}
+
+		if (sscanf(request, "%*s %4095s", argument) != 1 || argument[0] != '/') {
+			return reply_error(control, -EINVAL);
+		}
+
+		return reply_result(control, control->ops.profile(control->ops.ctx, argument));
+	}
+	else {
+		return reply_error(control, -EOPNOTSUPP);
+	}
+
+	return length;
+}
+
+int control_init(t_control *control, const char *path, const t_control_ops *ops) {
+	struct sockaddr_un address;
+	int enable = 1;
+
+	control->fd = -1;
+	control->ops = *ops;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		return -ENAMETOOLONG;
+	}
+
+	snprintf(control->path, sizeof(control->path), "%s", path);
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	control->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (control->fd == -1) {
+		return -errno;
+	}
+
+	// Left behind by a daemon that did not shut down cleanly
+	unlink(path);
+
+	if (bind(control->fd, (struct sockaddr *) &address, sizeof(address)) != 0
+			|| chmod(path, 0666) != 0
+			|| setsockopt(control->fd, SOL_SOCKET, SO_PASSCRED, &enable, sizeof(enable)) != 0) {
+		int result = -errno;
+		control_exit(control);
+		return result;
+	}
+
+	return 0;
+}
+
+void control_read(int fd, void *ctx) {
+	t_control *control = ctx;
+	struct sockaddr_un sender;
+	union {
+		struct cmsghdr header;
+		char buf[CMSG_SPACE(sizeof(struct ucred))];
+	} credentials;
+	struct iovec iov;
+	struct msghdr message;
+	ssize_t n;
+	int served = 0;
+
+	// The rest waits for the next wakeup, after the timer had its turn
+	while (served < CONTROL_REQUESTS_MAX) {
+		iov.iov_base = control->request;
+		iov.iov_len  = sizeof(control->request) - 1;
+
+		memset(&message, 0, sizeof(message));
+		message.msg_name       = &sender;
+		message.msg_namelen    = sizeof(sender);
+		message.msg_iov        = &iov;
+		message.msg_iovlen     = 1;
+		message.msg_control    = credentials.buf;
+		message.msg_controllen = sizeof(credentials.buf);
+
+		n = recvmsg(fd, &message, MSG_DONTWAIT);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return;
+		}
+
+		served++;
+		control->request[n] = '\0';
+
+		int privileged = 0;
+		struct cmsghdr *header;
+
+		for (header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)) {
+			if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_CREDENTIALS) {
+				struct ucred peer;
+				memcpy(&peer, CMSG_DATA(header), sizeof(peer));
+				privileged = peer.uid == 0;
+			}
+		}
+
+		size_t length = control_handle(control, control->request, privileged);
+
+		// An unbound sender cannot get a reply
+		if (message.msg_namelen > sizeof(sa_family_t)) {
+			sendto(fd, control->reply, length, MSG_DONTWAIT, (struct sockaddr *) &sender, message.msg_namelen);
+		}
+	}
+}
+
+void control_exit(t_control *control) {
+	if (control->fd != -1) {
+		close(control->fd);
+		unlink(control->path);
+	}
+
+	control->fd = -1;
+}
+
+int control_query(const char *path, const char *request, char *reply, size_t n_reply, int timeout_ms) {
+	struct sockaddr_un address;
+	sa_family_t family = AF_UNIX;
+	int result = 0;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		return -ENAMETOOLONG;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	if (fd == -1) {
+		return -errno;
+	}
+
+	// Binding only the family picks a unique abstract address to reply to
+	if (bind(fd, (struct sockaddr *) &family, sizeof(family)) != 0
+			|| connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0
+			|| send(fd, request, strlen(request), 0) < 0) {
+		result = -errno;
+		close(fd);
+		return result;
+	}
+
+	struct pollfd reply_fd = { .fd = fd, .events = POLLIN };
+
+	result = poll(&reply_fd, 1, timeout_ms);
+
+	if (result == 0) {
+		result = -ETIMEDOUT;
+	}
+	else if (result > 0) {
+		ssize_t n = recv(fd, reply, n_reply - 1, 0);
+		result = n < 0 ? -errno : (int) n;
+	}
+	else {
+		result = -errno;
+	}
+
+	if (result >= 0) {
+		reply[result] = '\0';
+	}
+
+	close(fd);
+	return result;
+}
@@ -0,0 +1,111 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stddef.h>
+
+/** Where the daemon listens for requests
+ */
+#define CONTROL_PATH "/run/mbpfan.sock"
+
+/** Longest request or reply, one datagram each, with room for the metrics
+ */
+#define CONTROL_MESSAGE_MAX 40960
+
+/** Most requests answered per wakeup, so a flood cannot hold off the ticks
+ */
+#define CONTROL_REQUESTS_MAX 16
+
+/** What the control loop did on its last tick
+ */
+struct s_control_state {
+	int temp;            // millidegrees the fans were set for
+	int speed;           // RPM chosen by the controller
+	int override_speed;  // RPM the fans are held at, 0 for none
+	int override_left;   // seconds the override still lasts
+	int interval_ms;
+	int late_ms;
+	unsigned long ticks;
+	unsigned long missed;
+};
+
+typedef struct s_control_state t_control_state;
+
+/** Requests changing the daemon, run from loop_wait() between two ticks
+ *  override - hold the fans at speed for seconds, release them for 0 seconds
+ *  profile  - load the settings file at path, absolute
+ *  Both return 0 on success and a negative errno otherwise
+ */
+struct s_control_ops {
+	int (*override)(void *ctx, int speed, int seconds);
+	int (*profile)(void *ctx, const char *path);
+	void *ctx;
+};
+
+typedef struct s_control_ops t_control_ops;
+
+/** A Unix datagram socket answering one reply per request
+ *  Anybody may query the state, only root may change it
+ */
+struct s_control {
+	int fd;  // -1 when not listening
+	char path[108];
+
+	t_control_state state;   // kept up to date by the control loop
+	const char     *profile; // settings file in use
+	t_control_ops   ops;
+
+	char request[CONTROL_MESSAGE_MAX];
+	char reply[CONTROL_MESSAGE_MAX];
+};
+
+typedef struct s_control t_control;
+
+/**
+ * Listen on a socket at path, replacing a stale one
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int control_init(t_control *control, const char *path, const t_control_ops *ops);
+
+/**
+ * Answer up to CONTROL_REQUESTS_MAX pending requests of the t_control
+ * in ctx, a loop_handler for control->fd that never blocks
+ */
+void control_read(int fd, void *ctx);
+
+/**
+ * Format the reply to request into control->reply, privileged when
+ * it comes from root
+ * Return the length of the reply
+ */
+size_t control_handle(t_control *control, const char *request, int privileged);
+
+/**
+ * Stop listening and remove the socket
+ */
+void control_exit(t_control *control);
+
+/**
+ * Send request to the daemon listening at path and wait up to
+ * timeout_ms for its reply, a string stored into reply
+ * Return the length of the reply
+ * Return a negative errno otherwise
+ */
+int control_query(const char *path, const char *request, char *reply, size_t n_reply, int timeout_ms);
+
+#endif
@@ -0,0 +1,192 @@
+/* curve.c - fan curve lookup tables
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * The curve is evaluated once per decidegree whenever the settings are
+ * loaded, so each tick only costs an index and a clamp.
+ *
+ * Configured curves interpolate between their points either linearly or
+ * with a monotone cubic spline (Fritsch-Carlson): the tangents are limited
+ * so the curve never rises or dips between points that do not.
+ */
+
+#include <math.h>
+#include "curve.h"
+
+void curve_build(t_curve *curve, int from, int to, curve_func up, curve_func down, const void *ctx) {
+	unsigned int i;
+
+	if (to < from) {
+		to = from;
+	}
+
+	curve->base    = from;
+	curve->top     = to;
+	curve->entries = (unsigned int)(to - from + CURVE_RESOLUTION - 1) / CURVE_RESOLUTION + 1;
+
+	if (curve->entries > CURVE_ENTRIES_MAX) {
+		curve->entries = CURVE_ENTRIES_MAX;
+	}
+
+	for (i = 0; i < curve->entries; i++) {
+		int temp = from + (int) i * CURVE_RESOLUTION;
+
+		// The last entry holds the end of the curve exactly
+		if (temp > to) {
+			temp = to;
+		}
+
+		curve->up[i]   = up(ctx, temp);
+		curve->down[i] = down(ctx, temp);
+	}
+}
+
+/* The first entry at or above a temperature, clamped to the table */
+static unsigned int curve_index(const t_curve *curve, int temp) {
+	int offset = temp - curve->base;
+
+	if (offset <= 0) {
+		return 0;
+	}
+
+	unsigned int index = (unsigned int)(offset + CURVE_RESOLUTION - 1) / CURVE_RESOLUTION;
+	return index < curve->entries ? index : curve->entries - 1;
+}
+
+int curve_up(const t_curve *curve, int temp) {
+	return curve->up[curve_index(curve, temp)];
+}
+
+int curve_down(const t_curve *curve, int temp) {
+	return curve->down[curve_index(curve, temp)];
+}
+
+int curve_points_prepare(t_curve_points *points, unsigned int count) {
+	double slope[CURVE_POINTS_MAX];
+	unsigned int i;
+
+	if (count < 2 || count > CURVE_POINTS_MAX) {
+		return 0;
+	}
+
+	for (i = 0; i + 1 < count; i++) {
+		if (points->temp[i + 1] <= points->temp[i]) {
+			return 0;
+		}
+
+		slope[i] = (double)(points->speed[i + 1] - points->speed[i]) / (points->temp[i + 1] - points->temp[i]);
+	}
+
+	points->tangent[0]         = slope[0];
+	points->tangent[count - 1] = slope[count - 2];
+
+	// Flat at local extrema, the mean of both secants elsewhere
+	for (i = 1; i + 1 < count; i++) {
+		points->tangent[i] = slope[i - 1] * slope[i] <= 0 ? 0 : (slope[i - 1] + slope[i]) / 2;
+	}
+
+	for (i = 0; i + 1 < count; i++) {
+		if (slope[i] == 0) {
+			points->tangent[i]     = 0;
+			points->tangent[i + 1] = 0;
+			continue;
+		}
+
+		double a = points->tangent[i] / slope[i];
+		double b = points->tangent[i + 1] / slope[i];
+		double r = a * a + b * b;
+
+		// Outside this circle the segment would overshoot
+		if (r > 9) {
+			double t = 3 / sqrt(r);
+			points->tangent[i]     = t * a * slope[i];
+			points->tangent[i + 1] = t * b * slope[i];
+		}
+	}
+
+	points->count = count;
+	return 1;
+}
+
+int curve_points_speed(const void *ctx, int temp) {
+	const t_curve_points *points = ctx;
+	unsigned int i;
+
+	if (temp <= points->temp[0]) {
+		return points->speed[0];
+	}
+
+	if (temp >= points->temp[points->count - 1]) {
+		return points->speed[points->count - 1];
+	}
+
+	for (i = 0; temp > points->temp[i + 1]; i++) {
+	}
+
+	double h  = points->temp[i + 1] - points->temp[i];
+	double t  = (temp - points->temp[i]) / h;
+	double y0 = points->speed[i];
+	double y1 = points->speed[i + 1];
+
+	if (points->interpolation == CURVE_LINEAR) {
+		return (int) lround(y0 + t * (y1 - y0));
+	}
+
+	// Cubic Hermite basis
+	double t2 = t * t;
+	double t3 = t2 * t;
+
+	return (int) lround((2 * t3 - 3 * t2 + 1) * y0 + (t3 - 2 * t2 + t) * h * points->tangent[i]
+		+ (-2 * t3 + 3 * t2) * y1 + (t3 - t2) * h * points->tangent[i + 1]);
+}
+
+int curve_step(const t_curve *curve, int speed, int temp, int temp_change) {
+	if (temp >= curve->top) {
+		return curve_up(curve, temp);
+	}
+
+	if (temp <= curve->base) {
+		return curve_down(curve, temp);
+	}
+
+	if (temp_change >= 0) {
+		int up = curve_up(curve, temp);
+		return speed > up ? speed : up;
+	}
+
+	int down = curve_down(curve, temp);
+	return speed < down ? speed : down;
+}
+
+/* Triangular number of a distance in millidegrees, in square millidegrees */
+static long long triangular(long long distance) {
+	return distance * (distance + 1000) / 2;
+}
+
+/* Ceiling of a non negative fraction */
+static long long div_ceil(long long numerator, long long denominator) {
+	return (numerator + denominator - 1) / denominator;
+}
+
+int curve_triangle_up(const void *ctx, int temp) {
+	const t_curve_triangle *t = ctx;
+	long long range = triangular((long long) t->max_temp - t->high_temp);
+
+	if (temp <= t->high_temp || range <= 0) {
+		return temp <= t->high_temp ? t->min_speed : t->max_speed;
+	}
+
+	return t->min_speed + (int) div_ceil((long long)(t->max_speed - t->min_speed) * triangular((long long) temp - t->high_temp), range);
+}
+
+int curve_triangle_down(const void *ctx, int temp) {
+	const t_curve_triangle *t = ctx;
+	long long range = triangular((long long) t->max_temp - t->low_temp);
+
+	if (temp >= t->max_temp || range <= 0) {
+		return t->max_speed;
+	}
+
+	return t->max_speed - (int) div_ceil((long long)(t->max_speed - t->min_speed) * triangular((long long) t->max_temp - temp), range);
+}
@@ -0,0 +1,119 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _CURVE_H_
+#define _CURVE_H_
+
+/** Millidegrees between two entries of a fan curve table
+ */
+#define CURVE_RESOLUTION  100
+#define CURVE_ENTRIES_MAX 2048
+
+/** Upper bound for the number of points of a configured curve
+ */
+#define CURVE_POINTS_MAX 32
+
+/** A fan curve materialized once per configuration: the fan speed of
+ *  the rising and falling branches for every decidegree from base
+ */
+struct s_curve {
+	int base;              // millidegrees of the first entry
+	int top;               // millidegrees of the last entry
+	unsigned int entries;
+
+	int up[CURVE_ENTRIES_MAX];
+	int down[CURVE_ENTRIES_MAX];
+};
+
+typedef struct s_curve t_curve;
+
+/** How a configured curve runs between its points
+ *  CURVE_LINEAR - straight segments
+ *  CURVE_CUBIC  - monotone cubic spline, never overshooting the points
+ */
+enum curve_interpolation {
+	CURVE_LINEAR,
+	CURVE_CUBIC,
+};
+
+/** Temperature and fan speed points of a configured curve
+ */
+struct s_curve_points {
+	unsigned int count;    // 0 when no curve is configured
+	int interpolation;
+
+	int temp[CURVE_POINTS_MAX];        // millidegrees, increasing
+	int speed[CURVE_POINTS_MAX];       // RPM
+	double tangent[CURVE_POINTS_MAX];  // RPM per millidegree, for CURVE_CUBIC
+};
+
+typedef struct s_curve_points t_curve_points;
+
+/** The historical triangular curve, temperatures in millidegrees
+ */
+struct s_curve_triangle {
+	int min_speed;
+	int max_speed;
+	int low_temp;
+	int high_temp;
+	int max_temp;
+};
+
+typedef struct s_curve_triangle t_curve_triangle;
+
+/** Fan speed at a temperature in millidegrees, for a curve being built
+ */
+typedef int (*curve_func)(const void *ctx, int temp);
+
+/**
+ * Sample up and down every CURVE_RESOLUTION millidegrees from temperature
+ * from to temperature to, both in millidegrees
+ */
+void curve_build(t_curve *curve, int from, int to, curve_func up, curve_func down, const void *ctx);
+
+/**
+ * Rising and falling branch of a t_curve_triangle at a temperature
+ * in millidegrees: curve_funcs for curve_build()
+ */
+int curve_triangle_up(const void *ctx, int temp);
+int curve_triangle_down(const void *ctx, int temp);
+
+/**
+ * Check the first count points and compute the spline tangents
+ * Return TRUE if the temperatures are strictly increasing
+ */
+int curve_points_prepare(t_curve_points *points, unsigned int count);
+
+/**
+ * Interpolated fan speed of a t_curve_points at a temperature in
+ * millidegrees, flat outside the points: a curve_func for curve_build()
+ */
+int curve_points_speed(const void *ctx, int temp);
+
+/**
+ * Fan speed of the rising and of the falling branch at a temperature
+ * in millidegrees, from the first entry at or above it
+ */
+int curve_up(const t_curve *curve, int temp);
+int curve_down(const t_curve *curve, int temp);
+
+/**
+ * One step along a curve: the fan speed following speed for a
+ * temperature and its change, in millidegrees
+ * Rising temperatures never lower the speed, falling ones never raise it
+ */
+int curve_step(const t_curve *curve, int speed, int temp, int temp_change);
+
+#endif
@@ -58,75 +58,7 @@ int delete_pid() {
 	return remove(PROGRAM_PID);
 }
 
-static void cleanup_and_exit(int exit_code) {
-	delete_pid();
-	set_fans_auto(fans);
-
-	struct s_fans *next_fan;
-	while (fans != NULL) {
-		next_fan = fans->next;
-
-		if (fans->file_output != NULL) {
-			fclose(fans->file_output);
-		}
-
-		free(fans->path_fan_output);
-		free(fans->path_fan_manual);
-		free(fans);
-		fans = next_fan;
-	}
-
-	struct s_sensors *next_sensor;
-
-	while (sensors != NULL) {
-		next_sensor = sensors->next;
-		if (sensors->file_input != NULL) {
-			fclose(sensors->file_input);
-		}
-
-		free(sensors->path);
-		free(sensors);
-
-		sensors = next_sensor;
-	}
-
-	exit(exit_code);
-}
-
-void signal_handler(int signal) {
-	switch(signal) {
-		case SIGHUP:
-			printf("Received SIGHUP signal\n");
-			retrieve_settings(NULL);
-			break;
-
-		case SIGTERM:
-			printf("Received SIGTERM signal\n");
-			cleanup_and_exit(EXIT_SUCCESS);
-			break;
-
-		case SIGQUIT:
-			printf("Received SIGQUIT signal\n");
-			cleanup_and_exit(EXIT_SUCCESS);
-			break;
-
-		case SIGINT:
-			printf("Received SIGINT signal\n");
-			cleanup_and_exit(EXIT_SUCCESS);
-			break;
-
-		default:
-			printf("Unhandled signal (%d) %s\n", signal, strsignal(signal));
-	}
-}
-
 void go_daemon(void (*fan_control)()) {
-	// Setup signal handling before we start
-	signal(SIGHUP, signal_handler);
-	signal(SIGTERM, signal_handler);
-	signal(SIGQUIT, signal_handler);
-	signal(SIGINT, signal_handler);
-
 	printf("%s starting up\n", PROGRAM_NAME);
 
 	int current_pid = getpid();
@@ -147,7 +79,9 @@ void go_daemon(void (*fan_control)()) {
 		exit(EXIT_FAILURE);
 	}
 
+	// Returns once asked to shut down, signals are handled in its event loop
 	fan_control();
 
+	delete_pid();
 	return;
 }
@@ -41,12 +41,8 @@ int read_pid();
 int delete_pid();
 
 /**
- * ...handles signals :-)
- */
-void signal_handler(int signal);
-
-/**
- * Daemonizes
+ * Daemonizes: runs function, which returns when asked to shut
+ * down, behind a .pid file
  */
 void go_daemon(void (*function)());
 
@@ -0,0 +1,65 @@
+/* estimator.c - per sensor temperature and rate estimation
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * An alpha-beta filter, the steady state form of a Kalman filter for a
+ * constant rate model: each sample corrects the extrapolated temperature
+ * by alpha of the residual and the rate by beta of it per unit of time.
+ * Single noisy samples move the estimate only a little, while a real
+ * ramp is picked up by the rate and extrapolated over the horizon, so
+ * the fans react before the temperature peaks.
+ */
+
+#include <limits.h>
+#include "estimator.h"
+
+void estimator_configure(t_estimator *estimator, double alpha, double beta, double horizon) {
+	estimator->alpha      = (int)(alpha * 1000.0);
+	estimator->beta       = (int)(beta * 1000.0);
+	estimator->horizon_ms = (int)(horizon * 1000.0);
+}
+
+void estimator_reset(t_estimator *estimator) {
+	estimator->count = 0;
+}
+
+void estimator_update(t_estimator *estimator, const int *samples, unsigned int count, int dt_ms) {
+	unsigned int i;
+
+	// The sensors changed, or this is the first sample: start from it
+	if (count != estimator->count) {
+		for (i = 0; i < count; i++) {
+			estimator->temp[i]      = samples[i] * 1000LL;
+			estimator->rate[i]      = 0;
+			estimator->predicted[i] = samples[i];
+		}
+
+		estimator->count = count;
+		return;
+	}
+
+	if (dt_ms <= 0) {
+		dt_ms = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		long long extrapolated = estimator->temp[i] + estimator->rate[i] * dt_ms / 1000;
+		long long residual     = samples[i] * 1000LL - extrapolated;
+
+		estimator->temp[i] = extrapolated + residual * estimator->alpha / 1000;
+		estimator->rate[i] += residual * estimator->beta / dt_ms;
+
+		long long predicted = (estimator->temp[i] + estimator->rate[i] * estimator->horizon_ms / 1000) / 1000;
+
+		if (predicted > INT_MAX) {
+			predicted = INT_MAX;
+		}
+
+		if (predicted < INT_MIN) {
+			predicted = INT_MIN;
+		}
+
+		estimator->predicted[i] = (int) predicted;
+	}
+}
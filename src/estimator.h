@@ -0,0 +1,57 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _ESTIMATOR_H_
+#define _ESTIMATOR_H_
+
+#include "global.h"
+
+/** Alpha-beta filter tracking the temperature and its rate of
+ *  change of every sensor, in integer fixed point
+ *  alpha, beta - gains in thousandths
+ *  horizon_ms  - how far ahead predicted[] looks
+ */
+struct s_estimator {
+	int alpha;
+	int beta;
+	int horizon_ms;
+
+	unsigned int count;    // sensors being tracked, 0 until the first update
+
+	long long temp[SENSORS_MAX];  // estimate, microdegrees
+	long long rate[SENSORS_MAX];  // estimate, microdegrees per second
+	int predicted[SENSORS_MAX];   // millidegrees, horizon_ms ahead
+};
+
+typedef struct s_estimator t_estimator;
+
+/**
+ * Set the gains, between 0 and 1, and the prediction horizon in seconds
+ * Keeps the estimates, so a reload does not disturb them
+ */
+void estimator_configure(t_estimator *estimator, double alpha, double beta, double horizon);
+
+/**
+ * Forget the estimates, the next update starts over from its samples
+ */
+void estimator_reset(t_estimator *estimator);
+
+/**
+ * Feed the samples of count sensors, in millidegrees, taken dt_ms after
+ * the previous ones, and refresh predicted[]
+ */
+void estimator_update(t_estimator *estimator, const int *samples, unsigned int count, int dt_ms);
+
+#endif
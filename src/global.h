@@ -3,31 +3,47 @@
 
 extern const char* PROGRAM_NAME;
 extern const char* PROGRAM_PID;
+extern const char* APPLESMC_PATH;
 
-struct s_fans {
-	FILE* file_output;
-	FILE* file_label;
-
-	char* path;  // TODO: unused
-	char* label;
-	char* path_fan_output;
-	char* path_fan_manual;
+/* Fixed capacities of the sensor and fan tables */
+#define SENSORS_MAX 128
+#define FANS_MAX    10
+#define LABEL_LEN   16
 
-	struct s_fans *next;
+/* Fan table, one column per fan, allocated once at discovery */
+struct s_fans {
+	unsigned int count;
+
+	unsigned long writes_issued;     // fanN_output writes made
+	unsigned long writes_suppressed; // fanN_output writes skipped as redundant
+
+	int          fd_output[FANS_MAX];     // open fanN_output
+	int          last_written[FANS_MAX];  // last speed written, -1 if unknown
+	int          min_speed[FANS_MAX];     // fanN_min, 0 if unknown
+	int          max_speed[FANS_MAX];     // fanN_max, 0 if unknown
+
+	int          fd_input[FANS_MAX];        // open fanN_input, -1 if missing
+	int          measured[FANS_MAX];        // last speed read back from fanN_input
+	unsigned int off_target[FANS_MAX];      // consecutive checks away from the written speed
+	unsigned int stalls[FANS_MAX];          // times the fan stopped while told to spin
+	unsigned int lags[FANS_MAX];            // times the fan did not reach its speed
+	unsigned int mode_reasserts[FANS_MAX];  // times manual mode had to be restored
+	unsigned int index[FANS_MAX];      // N in fanN_output
+	char         label[FANS_MAX][LABEL_LEN];
 };
 
+/* Sensor table, one column per sensor, allocated once at discovery */
 struct s_sensors {
-	FILE* file_input;
-	FILE* file_label;
-
-	char* path;
-	char* label;
-	char* path_sensor_input;
-	char* path_sensor_label;
+	unsigned int count;
 
-	unsigned int temperature;
+	unsigned int sample_syscalls;  // system calls made by the last refresh
+	long         sample_ns;        // wall time of the last refresh
 
-	struct s_sensors *next;
+	int          fd[SENSORS_MAX];           // open tempN_input
+	int          temperature[SENSORS_MAX];  // millidegrees
+	unsigned int index[SENSORS_MAX];        // N in tempN_input
+	unsigned int read_errors[SENSORS_MAX];  // failed reads since discovery
+	char         label[SENSORS_MAX][LABEL_LEN];
 };
 
 typedef struct s_fans    t_fans;
@@ -0,0 +1,626 @@
+/* history.c - compressed record of every tick
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Rows are compressed as in Facebook's Gorilla: times as the change of
+ * their delta, which is a single bit while polling is steady, and each
+ * value as its XOR with the previous one, a single bit while it does
+ * not change, otherwise only its meaningful bits. Most sensors move
+ * little between polls, so a row costs a few bits per sensor.
+ *
+ * Each block restarts the compression, so a block is decodable on its
+ * own and queries skip the blocks out of their range. The block being
+ * filled is written after every row, its stream first and its header
+ * last, so a crash loses at most the row being written.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "history.h"
+
+#define STREAM_BYTES (HISTORY_BLOCK_SIZE - sizeof(t_history_block))
+#define STREAM_BITS  (STREAM_BYTES * 8)
+
+/* Worst case of a row after the first: a 36 bit time and 44 bits per value */
+#define ROW_BITS_MAX(columns) (36 + 44 * (columns))
+
+/* Bit stream of one block, most significant bit first */
+struct s_stream {
+	unsigned char *bytes;
+	uint32_t bits;
+};
+
+typedef struct s_stream t_stream;
+
+/* Compression state of the previous row */
+struct s_encoder {
+	int64_t  time_ms;
+	int64_t  delta_ms;
+	uint32_t value[HISTORY_COLUMNS_MAX];
+	uint8_t  leading[HISTORY_COLUMNS_MAX];   // window of the last XOR written in full
+	uint8_t  trailing[HISTORY_COLUMNS_MAX];  // 32 for no window yet
+};
+
+typedef struct s_encoder t_encoder;
+
+static struct {
+	int       fd;
+	char      path[PATH_MAX];
+	long long max_size;
+	int       files;
+
+	t_history_header header;
+	off_t            block_offset;
+	uint32_t         written_bytes;  // of the stream, already in the file
+	unsigned char    block[HISTORY_BLOCK_SIZE];
+	t_encoder        encoder;
+} writer = { .fd = -1 };
+
+static void put_bits(t_stream *stream, uint64_t value, unsigned int count) {
+	while (count > 0) {
+		unsigned int free_bits = 8 - stream->bits % 8;
+		unsigned int n = count < free_bits ? count : free_bits;
+		unsigned int chunk = (unsigned int)(value >> (count - n)) & ((1U << n) - 1);
+
+		if (stream->bits % 8 == 0) {
+			stream->bytes[stream->bits / 8] = 0;
+		}
+
+		stream->bytes[stream->bits / 8] |= (unsigned char)(chunk << (free_bits - n));
+		stream->bits += n;
+		count -= n;
+	}
+}
+
+/* Return FALSE when the stream ends before count bits */
+static int get_bits(t_stream *stream, uint32_t end, unsigned int count, uint64_t *value) {
+	*value = 0;
+
+	// Written so that neither side can wrap around
+	if (stream->bits > end || count > end - stream->bits) {
+		return 0;
+	}
+
+	while (count > 0) {
+		unsigned int left = 8 - stream->bits % 8;
+		unsigned int n = count < left ? count : left;
+		unsigned int byte = stream->bytes[stream->bits / 8];
+
+		*value = (*value << n) | ((byte >> (left - n)) & ((1U << n) - 1));
+		stream->bits += n;
+		count -= n;
+	}
+
+	return 1;
+}
+
+static void encode_time(t_stream *stream, t_encoder *encoder, int64_t time_ms) {
+	int64_t delta = time_ms - encoder->time_ms;
+	int64_t dod   = delta - encoder->delta_ms;
+
+	if (dod == 0) {
+		put_bits(stream, 0, 1);
+	}
+	else if (dod >= -63 && dod <= 64) {
+		put_bits(stream, 0x2, 2);
+		put_bits(stream, (uint64_t)(dod + 63), 7);
+	}
+	else if (dod >= -255 && dod <= 256) {
+		put_bits(stream, 0x6, 3);
+		put_bits(stream, (uint64_t)(dod + 255), 9);
+	}
+	else if (dod >= -2047 && dod <= 2048) {
+		put_bits(stream, 0xe, 4);
+		put_bits(stream, (uint64_t)(dod + 2047), 12);
+	}
+	else {
+		put_bits(stream, 0xf, 4);
+		put_bits(stream, (uint32_t)(int32_t) dod, 32);
+	}
+
+	encoder->time_ms  = time_ms;
+	encoder->delta_ms = delta;
+}
+
+static int decode_time(t_stream *stream, uint32_t end, t_encoder *encoder) {
+	static const unsigned int widths[4] = { 7, 9, 12, 32 };
+	static const int64_t offsets[4] = { 63, 255, 2047, 0 };
+	uint64_t bit;
+	uint64_t raw;
+	int64_t dod = 0;
+	unsigned int prefix;
+
+	// Up to four 1 bits select the width of the change
+	for (prefix = 0; prefix < 4; prefix++) {
+		if (!get_bits(stream, end, 1, &bit)) {
+			return 0;
+		}
+
+		if (bit == 0) {
+			break;
+		}
+	}
+
+	if (prefix > 0) {
+		if (!get_bits(stream, end, widths[prefix - 1], &raw)) {
+			return 0;
+		}
+
+		dod = prefix == 4 ? (int64_t)(int32_t)(uint32_t) raw : (int64_t) raw - offsets[prefix - 1];
+	}
+
+	encoder->delta_ms += dod;
+	encoder->time_ms  += encoder->delta_ms;
+	return 1;
+}
+
+static void encode_value(t_stream *stream, t_encoder *encoder, unsigned int column, uint32_t value) {
+	uint32_t xor = value ^ encoder->value[column];
+
+	encoder->value[column] = value;
+
+	if (xor == 0) {
+		put_bits(stream, 0, 1);
+		return;
+	}
+
+	unsigned int leading  = (unsigned int) __builtin_clz(xor);
+	unsigned int trailing = (unsigned int) __builtin_ctz(xor);
+
+	// The meaningful bits fit the window of the previous XOR
+	if (encoder->trailing[column] < 32 && leading >= encoder->leading[column] && trailing >= encoder->trailing[column]) {
+		unsigned int length = 32 - encoder->leading[column] - encoder->trailing[column];
+
+		put_bits(stream, 0x2, 2);
+		put_bits(stream, xor >> encoder->trailing[column], length);
+		return;
+	}
+
+	unsigned int length = 32 - leading - trailing;
+
+	put_bits(stream, 0x3, 2);
+	put_bits(stream, leading, 5);
+	put_bits(stream, length - 1, 5);
+	put_bits(stream, xor >> trailing, length);
+
+	encoder->leading[column]  = (uint8_t) leading;
+	encoder->trailing[column] = (uint8_t) trailing;
+}
+
+static int decode_value(t_stream *stream, uint32_t end, t_encoder *encoder, unsigned int column) {
+	uint64_t control;
+	uint64_t leading;
+	uint64_t length;
+	uint64_t bits;
+
+	if (!get_bits(stream, end, 1, &control)) {
+		return 0;
+	}
+
+	if (control == 0) {
+		return 1;
+	}
+
+	if (!get_bits(stream, end, 1, &control)) {
+		return 0;
+	}
+
+	if (control == 1) {
+		if (!get_bits(stream, end, 5, &leading) || !get_bits(stream, end, 5, &length)) {
+			return 0;
+		}
+
+		// A corrupt window would not fit in the value
+		if (leading + length + 1 > 32) {
+			return 0;
+		}
+
+		encoder->leading[column]  = (uint8_t) leading;
+		encoder->trailing[column] = (uint8_t)(32 - leading - (length + 1));
+	}
+	else if (encoder->trailing[column] >= 32) {
+		// Reusing a window before any was written
+		return 0;
+	}
+
+	length = 32 - encoder->leading[column] - encoder->trailing[column];
+
+	if (!get_bits(stream, end, (unsigned int) length, &bits)) {
+		return 0;
+	}
+
+	encoder->value[column] ^= (uint32_t) bits << encoder->trailing[column];
+	return 1;
+}
+
+/* Name a column after its label, or after its sysfs file */
+static void column_label(char *out, const char *label, const char *prefix, unsigned int index) {
+	if (label[0] != '\0') {
+		memcpy(out, label, LABEL_LEN);
+		out[LABEL_LEN - 1] = '\0';
+	}
+	else {
+		snprintf(out, LABEL_LEN, "%s%u", prefix, index);
+	}
+}
+
+static int write_all(int fd, const void *buf, size_t count, off_t offset) {
+	const char *bytes = buf;
+
+	while (count > 0) {
+		ssize_t written = pwrite(fd, bytes, count, offset);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -errno;
+		}
+
+		bytes  += written;
+		count  -= (size_t) written;
+		offset += written;
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t count, off_t offset) {
+	char *bytes = buf;
+	size_t done = 0;
+
+	while (done < count) {
+		ssize_t n = pread(fd, bytes + done, count - done, offset + (off_t) done);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -errno;
+		}
+
+		if (n == 0) {
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	return (int) done;
+}
+
+/* Shift path.1 to path.files-1 up by one and make path the new path.1 */
+static void rotate(const char *path, int files) {
+	char from[PATH_MAX + 16];
+	char to[PATH_MAX + 16];
+	int i;
+
+	if (files <= 0) {
+		unlink(path);
+		return;
+	}
+
+	for (i = files - 1; i >= 1; i--) {
+		snprintf(from, sizeof(from), "%s.%d", path, i);
+		snprintf(to, sizeof(to), "%s.%d", path, i + 1);
+		rename(from, to);
+	}
+
+	snprintf(to, sizeof(to), "%s.1", path);
+	rename(path, to);
+}
+
+/* Create the file with its header, rotating any file already there */
+static int create_file() {
+	if (writer.fd != -1) {
+		close(writer.fd);
+		rotate(writer.path, writer.files);
+	}
+
+	writer.fd = open(writer.path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (writer.fd == -1) {
+		return -errno;
+	}
+
+	unsigned char first[HISTORY_BLOCK_SIZE];
+
+	memset(first, 0, sizeof(first));
+	memcpy(first, &writer.header, sizeof(writer.header));
+
+	writer.block_offset = HISTORY_BLOCK_SIZE;
+	return write_all(writer.fd, first, sizeof(first), 0);
+}
+
+/* Start an empty block after the last one, in a new file once the size is reached */
+static int start_block() {
+	t_history_block *block = (t_history_block *) writer.block;
+
+	if (writer.block_offset + HISTORY_BLOCK_SIZE > writer.max_size) {
+		int result = create_file();
+
+		if (result != 0) {
+			return result;
+		}
+	}
+
+	memset(writer.block, 0, sizeof(writer.block));
+	block->magic   = HISTORY_BLOCK_MAGIC;
+	block->columns = writer.header.sensor_count + writer.header.fan_count;
+
+	writer.written_bytes = 0;
+	return 0;
+}
+
+int history_init(const char *path, long long max_size, int files, const t_sensors *sensors, const t_fans *fans) {
+	t_history_header existing;
+	struct stat info;
+	unsigned int i;
+
+	history_exit();
+
+	if (strlen(path) >= sizeof(writer.path)) {
+		return -ENAMETOOLONG;
+	}
+
+	snprintf(writer.path, sizeof(writer.path), "%s", path);
+	writer.max_size = max_size > 2 * HISTORY_BLOCK_SIZE ? max_size : 2 * HISTORY_BLOCK_SIZE;
+	writer.files    = files;
+
+	memset(&writer.header, 0, sizeof(writer.header));
+	writer.header.magic        = HISTORY_MAGIC;
+	writer.header.version      = HISTORY_VERSION;
+	writer.header.sensor_count = sensors->count;
+	writer.header.fan_count    = fans->count;
+
+	for (i = 0; i < sensors->count; i++) {
+		column_label(writer.header.label[i], sensors->label[i], "temp", sensors->index[i]);
+	}
+
+	for (i = 0; i < fans->count; i++) {
+		column_label(writer.header.label[sensors->count + i], fans->label[i], "fan", fans->index[i]);
+	}
+
+	writer.fd = open(writer.path, O_RDWR | O_CLOEXEC);
+
+	// Appended to when it records the same columns, rotated otherwise
+	if (writer.fd != -1 && fstat(writer.fd, &info) == 0
+			&& read_all(writer.fd, &existing, sizeof(existing), 0) == (int) sizeof(existing)
+			&& memcmp(&existing, &writer.header, sizeof(existing)) == 0) {
+		writer.block_offset = (info.st_size + HISTORY_BLOCK_SIZE - 1) / HISTORY_BLOCK_SIZE * HISTORY_BLOCK_SIZE;
+	}
+	else {
+		int result = create_file();
+
+		if (result != 0) {
+			history_exit();
+			return result;
+		}
+	}
+
+	int result = start_block();
+
+	if (result != 0) {
+		history_exit();
+	}
+
+	return result;
+}
+
+int history_active() {
+	return writer.fd != -1;
+}
+
+int history_record(const t_sensors *sensors, const t_fans *fans) {
+	t_history_block *block = (t_history_block *) writer.block;
+	t_stream stream = { .bytes = writer.block + sizeof(t_history_block), .bits = block->bits };
+	unsigned int columns = writer.header.sensor_count + writer.header.fan_count;
+	struct timespec now;
+	unsigned int i;
+	int result;
+
+	if (writer.fd == -1) {
+		return -EBADF;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t time_ms = (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+	// A new block when this row might not fit, or its time could not be encoded
+	if (block->rows > 0 && (block->bits + ROW_BITS_MAX(columns) > STREAM_BITS
+			|| time_ms - writer.encoder.time_ms - writer.encoder.delta_ms > INT32_MAX
+			|| time_ms - writer.encoder.time_ms - writer.encoder.delta_ms < INT32_MIN)) {
+		writer.block_offset += HISTORY_BLOCK_SIZE;
+
+		if ((result = start_block()) != 0) {
+			return result;
+		}
+
+		stream.bits = 0;
+	}
+
+	if (block->rows == 0) {
+		block->first_ms = time_ms;
+
+		writer.encoder.time_ms  = time_ms;
+		writer.encoder.delta_ms = 0;
+
+		for (i = 0; i < columns; i++) {
+			uint32_t value = (uint32_t)(i < sensors->count ? sensors->temperature[i] : fans->last_written[i - sensors->count]);
+
+			put_bits(&stream, value, 32);
+			writer.encoder.value[i]    = value;
+			writer.encoder.trailing[i] = 32;
+		}
+	}
+	else {
+		encode_time(&stream, &writer.encoder, time_ms);
+
+		for (i = 0; i < columns; i++) {
+			encode_value(&stream, &writer.encoder, i, (uint32_t)(i < sensors->count ? sensors->temperature[i] : fans->last_written[i - sensors->count]));
+		}
+	}
+
+	block->rows++;
+	block->bits    = stream.bits;
+	block->last_ms = time_ms;
+
+	// The new bytes of the stream, then the header that makes them count
+	uint32_t used = (stream.bits + 7) / 8;
+	uint32_t from = writer.written_bytes;
+
+	result = write_all(writer.fd, stream.bytes + from, used - from, writer.block_offset + (off_t) sizeof(t_history_block) + from);
+
+	if (result == 0) {
+		result = write_all(writer.fd, block, sizeof(t_history_block), writer.block_offset);
+	}
+
+	// The last byte may not be full yet
+	writer.written_bytes = stream.bits / 8;
+	return result;
+}
+
+void history_exit() {
+	if (writer.fd != -1) {
+		close(writer.fd);
+	}
+
+	writer.fd = -1;
+}
+
+/* Decode the rows of one file in range */
+static int query_file(const char *path, long long from_ms, long long to_ms, history_row callback, void *ctx) {
+	static t_history_header header;
+	static unsigned char buf[HISTORY_BLOCK_SIZE];
+	static t_encoder decoder;
+	int32_t values[HISTORY_COLUMNS_MAX];
+	off_t offset;
+	unsigned int row;
+	unsigned int i;
+	int n;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1) {
+		return -errno;
+	}
+
+	if (read_all(fd, &header, sizeof(header), 0) != (int) sizeof(header) || header.magic != HISTORY_MAGIC) {
+		close(fd);
+		return -EPROTO;
+	}
+
+	// Each on its own, a sum could wrap around
+	if (header.version != HISTORY_VERSION || header.sensor_count > SENSORS_MAX || header.fan_count > FANS_MAX) {
+		close(fd);
+		return -EPROTO;
+	}
+
+	unsigned int columns = header.sensor_count + header.fan_count;
+
+	// Callers print the labels
+	for (i = 0; i < columns; i++) {
+		header.label[i][LABEL_LEN - 1] = '\0';
+	}
+	int first = 1;
+
+	for (offset = HISTORY_BLOCK_SIZE; (n = read_all(fd, buf, sizeof(buf), offset)) > 0; offset += HISTORY_BLOCK_SIZE) {
+		const t_history_block *block = (const t_history_block *) buf;
+		t_stream stream = { .bytes = buf + sizeof(t_history_block), .bits = 0 };
+
+		if ((size_t) n < sizeof(t_history_block) || block->magic != HISTORY_BLOCK_MAGIC || block->columns != columns) {
+			break;
+		}
+
+		if (block->last_ms < from_ms || block->first_ms > to_ms) {
+			continue;
+		}
+
+		// Whatever the file is missing of a block being written
+		uint32_t end = block->bits;
+
+		if (end > STREAM_BITS || sizeof(t_history_block) + (end + 7) / 8 > (size_t) n) {
+			end = ((uint32_t) n - sizeof(t_history_block)) * 8;
+		}
+
+		for (row = 0; row < block->rows; row++) {
+			if (row == 0) {
+				uint64_t value;
+
+				decoder.time_ms  = block->first_ms;
+				decoder.delta_ms = 0;
+
+				for (i = 0; i < columns; i++) {
+					if (!get_bits(&stream, end, 32, &value)) {
+						break;
+					}
+
+					decoder.value[i]    = (uint32_t) value;
+					decoder.trailing[i] = 32;
+				}
+
+				if (i < columns) {
+					break;
+				}
+			}
+			else {
+				if (!decode_time(&stream, end, &decoder)) {
+					break;
+				}
+
+				for (i = 0; i < columns; i++) {
+					if (!decode_value(&stream, end, &decoder, i)) {
+						break;
+					}
+				}
+
+				if (i < columns) {
+					break;
+				}
+			}
+
+			if (decoder.time_ms >= from_ms && decoder.time_ms <= to_ms) {
+				for (i = 0; i < columns; i++) {
+					values[i] = (int32_t) decoder.value[i];
+				}
+
+				callback(&header, first, decoder.time_ms, values, ctx);
+				first = 0;
+			}
+		}
+	}
+
+	close(fd);
+	return 0;
+}
+
+int history_query(const char *path, long long from_ms, long long to_ms, history_row callback, void *ctx) {
+	char rotated[PATH_MAX + 16];
+	int count = 0;
+	int result;
+
+	// Oldest first: the rotated files from the highest number down
+	do {
+		snprintf(rotated, sizeof(rotated), "%s.%d", path, ++count);
+	} while (access(rotated, R_OK) == 0);
+
+	while (--count > 0) {
+		snprintf(rotated, sizeof(rotated), "%s.%d", path, count);
+
+		if ((result = query_file(rotated, from_ms, to_ms, callback, ctx)) != 0) {
+			return result;
+		}
+	}
+
+	return query_file(path, from_ms, to_ms, callback, ctx);
+}
@@ -0,0 +1,102 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+#include "global.h"
+
+#define HISTORY_MAGIC       0x4d425048  // "MBPH"
+#define HISTORY_BLOCK_MAGIC 0x48424c4b  // "HBLK"
+#define HISTORY_VERSION     1
+
+/** Files are a header followed by blocks of this size, each decodable on its own
+ */
+#define HISTORY_BLOCK_SIZE 4096
+
+/** Every sensor, then every fan
+ */
+#define HISTORY_COLUMNS_MAX (SENSORS_MAX + FANS_MAX)
+
+/** First block of a file, naming its columns
+ *  Sensor columns hold millidegrees, fan columns the RPM written
+ */
+struct s_history_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sensor_count;
+	uint32_t fan_count;
+	char     label[HISTORY_COLUMNS_MAX][LABEL_LEN];  // label, or tempN and fanN
+};
+
+typedef struct s_history_header t_history_header;
+
+/** Start of every block, followed by its bit stream
+ *  Times are delta-of-delta encoded and values XORed with the previous
+ *  value of their column, the first row is stored as is
+ */
+struct s_history_block {
+	uint32_t magic;
+	uint32_t rows;
+	uint32_t bits;      // of the stream in use
+	uint32_t columns;
+	int64_t  first_ms;  // CLOCK_REALTIME of the first row
+	int64_t  last_ms;   // and of the last one, so queries skip blocks
+};
+
+typedef struct s_history_block t_history_block;
+
+/** Called by history_query() for every row in range, first is TRUE for
+ *  the first one of each file, whose header may name other columns
+ */
+typedef void (*history_row)(const t_history_header *header, int first, long long time_ms, const int32_t *values, void *ctx);
+
+/**
+ * Record the sensors and fans into the file at path from now on,
+ * appending to it if it has the same columns, and rotating it into
+ * path.1 to path.files once it would grow beyond max_size bytes
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int history_init(const char *path, long long max_size, int files, const t_sensors *sensors, const t_fans *fans);
+
+/**
+ * Return TRUE if history_init() succeeded
+ */
+int history_active();
+
+/**
+ * Append the current samples and fan speeds as one row
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int history_record(const t_sensors *sensors, const t_fans *fans);
+
+/**
+ * Close the file, if any
+ */
+void history_exit();
+
+/**
+ * Decode the rows between from_ms and to_ms, CLOCK_REALTIME milliseconds,
+ * of the file at path and its rotated predecessors, oldest first,
+ * one block at a time
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int history_query(const char *path, long long from_ms, long long to_ms, history_row callback, void *ctx);
+
+#endif
@@ -0,0 +1,222 @@
+/* loop.c - the event loop of the daemon
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Signals are blocked and read from a signalfd, and ticks come from a
+ * timerfd, both through one epoll instance. A reload or a shutdown is
+ * thus only ever acted upon between two ticks, from the main thread,
+ * instead of from a signal handler that may interrupt anything.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "loop.h"
+
+#define NS_PER_S 1000000000LL
+
+/* epoll data of the two built in sources, watches use their index */
+#define SOURCE_SIGNAL (LOOP_WATCHES_MAX)
+#define SOURCE_TIMER  (LOOP_WATCHES_MAX + 1)
+
+static int add_source(t_loop *loop, int fd, unsigned int source) {
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events   = EPOLLIN;
+	event.data.u32 = source;
+
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0 ? 0 : -errno;
+}
+
+int loop_init(t_loop *loop) {
+	int result;
+
+	memset(loop, 0, sizeof(*loop));
+	loop->epoll_fd  = -1;
+	loop->signal_fd = -1;
+	loop->timer_fd  = -1;
+
+	sigemptyset(&loop->signals);
+	sigaddset(&loop->signals, SIGHUP);
+	sigaddset(&loop->signals, SIGTERM);
+	sigaddset(&loop->signals, SIGINT);
+	sigaddset(&loop->signals, SIGQUIT);
+
+	if (sigprocmask(SIG_BLOCK, &loop->signals, &loop->saved_mask) != 0) {
+		return -errno;
+	}
+
+	loop->epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+	loop->signal_fd = signalfd(-1, &loop->signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	loop->timer_fd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (loop->epoll_fd == -1 || loop->signal_fd == -1 || loop->timer_fd == -1) {
+		result = -errno;
+		loop_exit(loop);
+		return result;
+	}
+
+	if ((result = add_source(loop, loop->signal_fd, SOURCE_SIGNAL)) != 0 || (result = add_source(loop, loop->timer_fd, SOURCE_TIMER)) != 0) {
+		loop_exit(loop);
+		return result;
+	}
+
+	return 0;
+}
+
+void loop_arm(t_loop *loop, long long deadline_ns) {
+	struct itimerspec timer;
+
+	memset(&timer, 0, sizeof(timer));
+
+	// A zero value would disarm the timer instead of firing it
+	if (deadline_ns <= 0) {
+		deadline_ns = 1;
+	}
+
+	timer.it_value.tv_sec  = deadline_ns / NS_PER_S;
+	timer.it_value.tv_nsec = deadline_ns % NS_PER_S;
+
+	timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+int loop_watch(t_loop *loop, int fd, loop_handler handler, void *ctx) {
+	if (loop->watches == LOOP_WATCHES_MAX) {
+		return -ENOSPC;
+	}
+
+	int result = add_source(loop, fd, loop->watches);
+
+	if (result != 0) {
+		return result;
+	}
+
+	loop->watch_fd[loop->watches]      = fd;
+	loop->watch_handler[loop->watches] = handler;
+	loop->watch_ctx[loop->watches]     = ctx;
+	loop->watches++;
+
+	return 0;
+}
+
+void loop_unwatch(t_loop *loop, int fd) {
+	unsigned int i;
+
+	for (i = 0; i < loop->watches; i++) {
+		if (loop->watch_fd[i] == fd) {
+			break;
+		}
+	}
+
+	if (i == loop->watches) {
+		return;
+	}
+
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	loop->watches--;
+
+	// The last watch takes the freed index, which is its epoll data
+	if (i != loop->watches) {
+		struct epoll_event event;
+
+		loop->watch_fd[i]      = loop->watch_fd[loop->watches];
+		loop->watch_handler[i] = loop->watch_handler[loop->watches];
+		loop->watch_ctx[i]     = loop->watch_ctx[loop->watches];
+
+		memset(&event, 0, sizeof(event));
+		event.events   = EPOLLIN;
+		event.data.u32 = i;
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, loop->watch_fd[i], &event);
+	}
+}
+
+void loop_request(t_loop *loop, enum loop_event event) {
+	loop->pending |= event;
+}
+
+static void read_signals(t_loop *loop) {
+	struct signalfd_siginfo info;
+
+	while (read(loop->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		switch (info.ssi_signo) {
+			case SIGHUP:
+				printf("Received SIGHUP signal\n");
+				loop->pending |= LOOP_RELOAD;
+				break;
+
+			default:
+				printf("Received %s signal\n", info.ssi_signo == SIGTERM ? "SIGTERM" : info.ssi_signo == SIGINT ? "SIGINT" : "SIGQUIT");
+				loop->pending |= LOOP_EXIT;
+				break;
+		}
+	}
+}
+
+enum loop_event loop_wait(t_loop *loop) {
+	struct epoll_event events[LOOP_WATCHES_MAX + 2];
+
+	while (loop->pending == 0) {
+		int count = epoll_wait(loop->epoll_fd, events, LOOP_WATCHES_MAX + 2, -1);
+		int i;
+
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			printf("ERROR: epoll_wait failed: %s\n", strerror(errno));
+			loop->pending |= LOOP_EXIT;
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			unsigned int source = events[i].data.u32;
+
+			if (source == SOURCE_SIGNAL) {
+				read_signals(loop);
+			}
+			else if (source == SOURCE_TIMER) {
+				unsigned long long expirations;
+
+				if (read(loop->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+					loop->pending |= LOOP_TIMER;
+				}
+			}
+			else if (source < loop->watches) {
+				loop->watch_handler[source](loop->watch_fd[source], loop->watch_ctx[source]);
+			}
+		}
+	}
+
+	// The lowest bit is the most urgent
+	enum loop_event event = loop->pending & -loop->pending;
+	loop->pending &= ~event;
+
+	return event;
+}
+
+void loop_exit(t_loop *loop) {
+	if (loop->timer_fd != -1) {
+		close(loop->timer_fd);
+	}
+
+	if (loop->signal_fd != -1) {
+		close(loop->signal_fd);
+	}
+
+	if (loop->epoll_fd != -1) {
+		close(loop->epoll_fd);
+	}
+
+	loop->timer_fd  = -1;
+	loop->signal_fd = -1;
+	loop->epoll_fd  = -1;
+
+	sigprocmask(SIG_SETMASK, &loop->saved_mask, NULL);
+}
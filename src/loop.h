@@ -0,0 +1,101 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _LOOP_H_
+#define _LOOP_H_
+
+#include <signal.h>
+
+/** Upper bound for the file descriptors watched besides the signals and the timer
+ */
+#define LOOP_WATCHES_MAX 8
+
+/** What loop_wait() returns, most urgent first
+ *  LOOP_EXIT   - SIGTERM, SIGINT or SIGQUIT, or loop_request()
+ *  LOOP_RELOAD - SIGHUP, or loop_request()
+ *  LOOP_TIMER  - the time given to loop_arm() has come
+ */
+enum loop_event {
+	LOOP_EXIT   = 1 << 0,
+	LOOP_RELOAD = 1 << 1,
+	LOOP_TIMER  = 1 << 2,
+};
+
+/** Called from loop_wait() when a watched file descriptor is readable
+ */
+typedef void (*loop_handler)(int fd, void *ctx);
+
+struct s_loop {
+	int epoll_fd;
+	int signal_fd;
+	int timer_fd;
+
+	sigset_t signals;      // blocked and read through signal_fd
+	sigset_t saved_mask;   // mask before loop_init()
+
+	unsigned int pending;  // enum loop_event bits not returned yet
+
+	unsigned int watches;
+	int          watch_fd[LOOP_WATCHES_MAX];
+	loop_handler watch_handler[LOOP_WATCHES_MAX];
+	void        *watch_ctx[LOOP_WATCHES_MAX];
+};
+
+typedef struct s_loop t_loop;
+
+/**
+ * Block SIGHUP, SIGTERM, SIGINT and SIGQUIT and receive them through
+ * a signalfd instead, next to a CLOCK_MONOTONIC timerfd
+ * Must run before any thread is started, so they inherit the mask
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int loop_init(t_loop *loop);
+
+/**
+ * Fire LOOP_TIMER once, at an absolute CLOCK_MONOTONIC time in nanoseconds
+ */
+void loop_arm(t_loop *loop, long long deadline_ns);
+
+/**
+ * Call handler with ctx from loop_wait() whenever fd is readable
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int loop_watch(t_loop *loop, int fd, loop_handler handler, void *ctx);
+
+/**
+ * Stop watching fd, not from within a handler
+ */
+void loop_unwatch(t_loop *loop, int fd);
+
+/**
+ * Make the next loop_wait() return event, for handlers of watched descriptors
+ */
+void loop_request(t_loop *loop, enum loop_event event);
+
+/**
+ * Wait for the next event, running the handlers of the watched
+ * descriptors that become readable meanwhile
+ * Return the most urgent enum loop_event pending
+ */
+enum loop_event loop_wait(t_loop *loop);
+
+/**
+ * Close the descriptors and restore the signal mask
+ */
+void loop_exit(t_loop *loop);
+
+#endif
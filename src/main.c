@@ -3,17 +3,27 @@
  * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
  */
 
+// strptime()
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
 #include "mbpfan.h"
 #include "daemon.h"
 #include "global.h"
 #include "minunit.h"
+#include "control.h"
+#include "history.h"
+#include "telemetry.h"
 
 const char *PROGRAM_NAME = "mbpfan";
 const char *PROGRAM_PID  = "/run/mbpfan.pid";
@@ -25,8 +35,16 @@ void print_usage(int argc, char *argv[]) {
 	if (argc >=1) {
 		printf("Usage: %s OPTION(S) \n", argv[0]);
 		printf("Options:\n");
-		printf("\t-h Show this help screen\n");
-		printf("\t-t Run the tests\n");
+		printf("\t-h, --help     Show this help screen\n");
+		printf("\t-t, --test     Run the tests\n");
+		printf("\t-a, --autotune Step the fans, measure the thermal response and write PID gains to /etc/mbpfan.conf\n");
+		printf("\t-c, --control  Send the rest of the command line as a request to the running daemon:\n");
+		printf("\t               state, sensors, fans, metrics, override SPEED SECONDS, override off or profile FILE\n");
+		printf("\t--history[=FILE] Print the recorded history, of history_file in /etc/mbpfan.conf without FILE\n");
+		printf("\t--from TIME      Only from TIME on, as seconds since the epoch or YYYY-MM-DD[ HH:MM[:SS]]\n");
+		printf("\t--to TIME        Only up to TIME\n");
+		printf("\t--sensor NAME    Only the sensor or fan named NAME, such as TC0P, temp3 or fan1\n");
+		printf("\t--telemetry[=FILE] Print the last poll published by the daemon, in %s without FILE\n", TELEMETRY_PATH);
 		printf("\n");
 	}
 }
@@ -61,10 +79,260 @@ void check_requirements() {
 }
 
 
+/* Options without a short form */
+enum {
+	OPTION_HISTORY = 256,
+	OPTION_FROM,
+	OPTION_TO,
+	OPTION_SENSOR,
+	OPTION_TELEMETRY,
+};
+
+static const struct option long_options[] = {
+	{ "help",     no_argument, NULL, 'h' },
+	{ "test",     no_argument, NULL, 't' },
+	{ "autotune", no_argument, NULL, 'a' },
+	{ "control",  no_argument, NULL, 'c' },
+	{ "history",  optional_argument, NULL, OPTION_HISTORY },
+	{ "from",     required_argument, NULL, OPTION_FROM },
+	{ "to",       required_argument, NULL, OPTION_TO },
+	{ "sensor",   required_argument, NULL, OPTION_SENSOR },
+	{ "telemetry", optional_argument, NULL, OPTION_TELEMETRY },
+	{ NULL,       0,           NULL, 0   },
+};
+
+/* Send the words of argv as one request to the daemon and print its reply */
+int control_client(int argc, char *argv[]) {
+	char request[CONTROL_MESSAGE_MAX] = "";
+	char reply[CONTROL_MESSAGE_MAX];
+	char resolved[PATH_MAX];
+	size_t length = 0;
+	int i;
+
+	for (i = 0; i < argc; i++) {
+		const char *word = argv[i];
+
+		// The daemon does not share the working directory of the client
+		if (i == 1 && strcmp(argv[0], "profile") == 0 && realpath(word, resolved) != NULL) {
+			word = resolved;
+		}
+
+		length += snprintf(request + length, sizeof(request) - length, "%s%s", i > 0 ? " " : "", word);
+
+		if (length >= sizeof(request)) {
+			printf("Request too long\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	int result = control_query(CONTROL_PATH, request, reply, sizeof(reply), 2000);
+
+	if (result < 0) {
+		printf("Could not reach %s on %s: %s\n", PROGRAM_NAME, CONTROL_PATH, strerror(-result));
+		return EXIT_FAILURE;
+	}
+
+	printf("%s\n", reply);
+	return strncmp(reply, "ok", 2) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Parse seconds since the epoch or a local date and time into milliseconds
+ * Return FALSE if text is neither
+ */
+static bool parse_time(const char *text, long long *time_ms) {
+	static const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+	struct tm tm;
+	char *end;
+	unsigned int i;
+
+	long long seconds = strtoll(text, &end, 10);
+
+	if (end != text && *end == '\0') {
+		*time_ms = seconds * 1000;
+		return true;
+	}
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(text, formats[i], &tm);
+
+		if (end != NULL && *end == '\0') {
+			tm.tm_isdst = -1;
+			*time_ms = (long long) mktime(&tm) * 1000;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+struct s_history_print {
+	const char *sensor;
+	int column;  // of sensor in the current file, -1 if it has none
+	bool found;  // in any file
+	unsigned long rows;
+};
+
+/* Print millidegrees as degrees */
+static void print_milli(int value) {
+	unsigned int magnitude = value < 0 ? 0U - (unsigned int) value : (unsigned int) value;
+	printf(" %s%u.%03u", value < 0 ? "-" : "", magnitude / 1000, magnitude % 1000);
+}
+
+static void print_value(const t_history_header *header, unsigned int column, int value) {
+	// Sensors hold millidegrees, fans RPM
+	if (column < header->sensor_count) {
+		print_milli(value);
+	}
+	else {
+		printf(" %d", value);
+	}
+}
+
+static void print_history_row(const t_history_header *header, int first, long long time_ms, const int32_t *values, void *ctx) {
+	struct s_history_print *print = ctx;
+	unsigned int columns = header->sensor_count + header->fan_count;
+	char when[32];
+	unsigned int i;
+
+	print->rows++;
+
+	// Columns are looked up again whenever a file starts
+	if (first) {
+		print->column = -1;
+
+		if (print->sensor == NULL) {
+			printf("# time");
+
+			for (i = 0; i < columns; i++) {
+				printf(" %s", header->label[i]);
+			}
+
+			printf("\n");
+		}
+		else {
+			for (i = 0; i < columns && print->column < 0; i++) {
+				if (strncmp(header->label[i], print->sensor, LABEL_LEN) == 0) {
+					print->column = (int) i;
+					print->found  = true;
+				}
+			}
+		}
+	}
+
+	if (print->sensor != NULL && print->column < 0) {
+		return;
+	}
+
+	time_t seconds = (time_t)(time_ms / 1000);
+	struct tm tm;
+
+	localtime_r(&seconds, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%03lld", when, time_ms % 1000);
+
+	if (print->sensor != NULL) {
+		print_value(header, (unsigned int) print->column, values[print->column]);
+	}
+	else {
+		for (i = 0; i < columns; i++) {
+			print_value(header, i, values[i]);
+		}
+	}
+
+	printf("\n");
+}
+
+/* Stream the recorded rows between from_ms and to_ms */
+int history_client(const char *path, long long from_ms, long long to_ms, const char *sensor) {
+	struct s_history_print print = { .sensor = sensor, .column = -1, .found = false, .rows = 0 };
+
+	int result = history_query(path, from_ms, to_ms, print_history_row, &print);
+
+	if (result != 0) {
+		printf("Could not read the history in %s: %s\n", path, strerror(-result));
+		return EXIT_FAILURE;
+	}
+
+	if (sensor != NULL && print.rows > 0 && !print.found) {
+		printf("No sensor or fan named %s in %s\n", sensor, path);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Print a snapshot of the segment the daemon publishes at path */
+int telemetry_client(const char *path) {
+	static t_telemetry snapshot;
+	const t_telemetry *segment;
+	struct timespec now;
+	unsigned int i;
+
+	int result = telemetry_attach(path, &segment);
+
+	if (result == 0) {
+		result = telemetry_read(segment, &snapshot);
+		telemetry_detach(segment);
+	}
+
+	if (result != 0) {
+		printf("Could not read the telemetry in %s: %s\n", path, strerror(-result));
+		return EXIT_FAILURE;
+	}
+
+	// How long ago the daemon published, a stopped one stays put
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long age_ms = ((long long) now.tv_sec * 1000000000LL + now.tv_nsec - snapshot.monotonic_ns) / 1000000;
+
+	printf("tick %llu missed %llu age_ms %lld elapsed_ms %d late_ms %d sample_us %d\n", (unsigned long long) snapshot.ticks,
+		(unsigned long long) snapshot.missed, snapshot.monotonic_ns != 0 ? age_ms : -1LL, snapshot.elapsed_ms, snapshot.late_ms, snapshot.sample_us);
+
+	printf("temp");
+	print_milli(snapshot.temp);
+	printf(" control_temp");
+	print_milli(snapshot.control_temp);
+	printf(" speed %d\n", snapshot.speed);
+
+	// Named like the history columns
+	for (i = 0; i < snapshot.sensor_count && i < SENSORS_MAX; i++) {
+		if (snapshot.sensor_label[i][0] != '\0') {
+			printf("sensor %.*s", LABEL_LEN - 1, snapshot.sensor_label[i]);
+		}
+		else {
+			printf("sensor temp%u", snapshot.sensor_index[i]);
+		}
+
+		print_milli(snapshot.sensor_temp[i]);
+		printf(" errors %u\n", snapshot.sensor_errors[i]);
+	}
+
+	for (i = 0; i < snapshot.fan_count && i < FANS_MAX; i++) {
+		if (snapshot.fan_label[i][0] != '\0') {
+			printf("fan %.*s", LABEL_LEN - 1, snapshot.fan_label[i]);
+		}
+		else {
+			printf("fan fan%u", snapshot.fan_index[i]);
+		}
+
+		printf(" speed %d measured %d\n", snapshot.fan_speed[i], snapshot.fan_measured[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
 	int c;
+	bool autotune = false;
+	bool history = false;
+	const char *history_path = NULL;
+	char history_setting[PATH_MAX];
+	const char *sensor = NULL;
+	long long from_ms = LLONG_MIN;
+	long long to_ms = LLONG_MAX;
 
-	while( (c = getopt(argc, argv, "ht|help")) != -1) {
+	// "+" stops at the first request word, so "override -1 5" is not taken for options
+	while( (c = getopt_long(argc, argv, "+htac", long_options, NULL)) != -1) {
 		switch(c) {
 			case 'h':
 				print_usage(argc, argv);
@@ -76,6 +344,44 @@ int main(int argc, char *argv[]) {
 				exit(EXIT_SUCCESS);
 				break;
 
+			case 'a':
+				autotune = true;
+				break;
+
+			case 'c':
+				if (optind == argc) {
+					print_usage(argc, argv);
+					exit(EXIT_FAILURE);
+				}
+
+				exit(control_client(argc - optind, argv + optind));
+				break;
+
+			case OPTION_HISTORY:
+				history = true;
+
+				if (optarg != NULL) {
+					history_path = optarg;
+				}
+				break;
+
+			case OPTION_FROM:
+			case OPTION_TO:
+				if (!parse_time(optarg, c == OPTION_FROM ? &from_ms : &to_ms)) {
+					printf("Invalid time '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case OPTION_SENSOR:
+				sensor = optarg;
+				break;
+
+			case OPTION_TELEMETRY:
+				// Reading the segment needs neither root nor the modules
+				exit(telemetry_client(optarg != NULL ? optarg : TELEMETRY_PATH));
+				break;
+
 			default:
 				print_usage(argc, argv);
 				exit(EXIT_SUCCESS);
@@ -83,8 +389,33 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	// Reading the history needs neither root nor the modules
+	if (history) {
+		if (history_path == NULL) {
+			// What the daemon records into
+			if (!retrieve_history_file(NULL, history_setting, sizeof(history_setting))) {
+				printf("history_file is not set in /etc/mbpfan.conf, set it to record a history or pass --history=FILE\n");
+				exit(EXIT_FAILURE);
+			}
+
+			history_path = history_setting;
+		}
+
+		exit(history_client(history_path, from_ms, to_ms, sensor));
+	}
+
 	check_requirements();
 
+	if (autotune) {
+		// The daemon would fight over the fans
+		if (read_pid() != -1) {
+			printf("%s is running, stop it before autotuning. Exiting.\n", PROGRAM_NAME);
+			exit(EXIT_FAILURE);
+		}
+
+		exit(mbpfan_autotune(NULL) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
 	// pointer to mbpfan() function in mbpfan.c
 	void (*fan_control)() = mbpfan;
 	go_daemon(fan_control);
@@ -17,18 +17,39 @@
  */
 
 
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <math.h>
 #include <stdbool.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <sys/utsname.h>
 #include <sys/errno.h>
 #include "mbpfan.h"
 #include "global.h"
 #include "settings.h"
+#include "sysfs.h"
+#include "uring.h"
+#include "pool.h"
+#include "aggregate.h"
+#include "pid.h"
+#include "scheduler.h"
+#include "estimator.h"
+#include "zone.h"
+#include "autotune.h"
+#include "loop.h"
+#include "curve.h"
+#include "watch.h"
+#include "control.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "history.h"
+
+#define SETTINGS_PATH "/etc/mbpfan.conf"
 
 /* lazy min/max... */
 #define min(a,b) ((a) < (b) ? (a) : (b))
@@ -45,224 +66,376 @@ int low_temp  = 20;  // try ranges 55-63
 int high_temp = 35;  // try ranges 58-66
 int max_temp  = 50;  // do not set it > 90
 
-int polling_interval = 1;
+int polling_interval_ms = 1000;
+
+/* stretch the polling interval while cold and stable, tighten it when heating up */
+int adaptive_polling        = 0;
+int polling_interval_min_ms = 500;
+int polling_interval_max_ms = 10000;
+int adaptive_rise_rate      = 500;  // millidegrees per second
+int adaptive_stable_rate    = 50;   // millidegrees per second
+
+/* reload the settings by itself when their file changes */
+int watch_config = 0;
+
+/* answer requests on the control socket */
+int control_socket = 0;
+
+/* publish every tick in shared memory */
+int shared_telemetry = 0;
+
+/* node exporter textfile rewritten every tick, empty for none */
+char metrics_textfile[PATH_MAX] = "";
+
+/* compressed record of every tick, empty for none, rotated past history_max_size megabytes */
+char history_file[PATH_MAX] = "";
+int  history_max_size       = 64;
+int  history_files          = 4;
+
+/* settings file in use, the control socket can load another one */
+static char profile[PATH_MAX] = SETTINGS_PATH;
+
+/* speed the control socket holds the fans at, until override_until in CLOCK_MONOTONIC nanoseconds */
+static int       override_speed = 0;
+static long long override_until = 0;
+
+/* speed changes up to this many RPM are not written to the fans */
+int fan_speed_deadband = 0;
+
+/* control law driving the fans, see enum control_mode */
+int control_mode = CONTROL_TRIANGLE;
+
+/* PID tuning: setpoint in degrees (0 means high_temp), gains in RPM per degree,
+ * per degree-second and RPM-seconds per degree, derivative filter in seconds */
+double pid_setpoint = 0;
+double pid_kp       = 400;
+double pid_ki       = 20;
+double pid_kd       = 0;
+double pid_filter   = 2;
+
+t_pid pid;
+
+/* the fan curve, rebuilt by build_curve() whenever the settings change */
+t_curve curve;
+
+/* points of the [curve] section, none to follow the triangle */
+t_curve_points curve_points;
+
+/* the [zone:NAME] sections, their fans leave the main controller */
+t_zone zones[ZONES_MAX];
+unsigned int zone_count = 0;
+
+/* read the fan speeds back after every write, see check_fans() */
+int tach_feedback  = 0;
+int tach_tolerance = 300;
+int tach_checks    = 3;
+
+/* sample all sensors of a tick with one io_uring submission */
+int use_io_uring = 0;
+
+/* read sensors from this many threads, 0 reads them one by one */
+int sensor_workers = 0;
+
+/* with workers, start reading this many milliseconds before the next poll */
+int sensor_prefetch_ms = 0;
+
+int (*sensor_read)(int fd, int *out) = sysfs_read_int;
+
+t_aggregation aggregation = {
+	.method     = AGGREGATE_MEAN,
+	.k          = 1,
+	.percentile = 100,
+};
+
+/* filter every sensor and control on the temperature predicted ahead */
+int    temp_estimator     = 0;
+double estimator_alpha    = 0.3;
+double estimator_beta     = 0.05;
+double prediction_horizon = 5;
+
+t_estimator estimator;
 
 t_sensors* sensors = NULL;
 t_fans* fans = NULL;
 
 
-static char *smprintf(const char *fmt, ...) __attribute__((format (printf, 1, 2)));
+/* Read the first word of a sysfs label file, empty string if missing */
+static void read_label(const char *path, char *label) {
+	label[0] = '\0';
+
+	FILE *file = fopen(path, "r");
+
+	if (file == NULL) {
+		return;
+	}
 
-static char *smprintf(const char *fmt, ...) {
-	char *buf;
-	int cnt;
-	va_list ap;
+	if (fscanf(file, "%15s", label) != 1) {
+		label[0] = '\0';
+	}
 
-	// Find buffer length
-	va_start(ap, fmt);
-	cnt = vsnprintf(NULL, 0, fmt, ap);
-	va_end(ap);
+	fclose(file);
+}
 
-	if (cnt < 0) return NULL;
+/* Read an integer sysfs attribute once, 0 if missing or unreadable */
+static int read_attribute(const char *path) {
+	int value = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
 
-	// Create and write to buffer
-	buf = malloc(cnt + 1);
-	va_start(ap, fmt);
-	vsnprintf(buf, cnt + 1, fmt, ap);
-	va_end(ap);
+	if (fd == -1) {
+		return 0;
+	}
 
-	return buf;
+	if (sysfs_read_int(fd, &value) != 0) {
+		value = 0;
+	}
+
+	close(fd);
+	return value;
+}
+
+/* Make room for a sensor in the table, keeping it ordered by index; return its position */
+static unsigned int sensor_slot(t_sensors *sensors, unsigned int index) {
+	unsigned int pos = sensors->count;
+
+	while (pos > 0 && sensors->index[pos - 1] > index) {
+		sensors->fd[pos]          = sensors->fd[pos - 1];
+		sensors->temperature[pos] = sensors->temperature[pos - 1];
+		sensors->read_errors[pos] = sensors->read_errors[pos - 1];
+		sensors->index[pos]       = sensors->index[pos - 1];
+		memcpy(sensors->label[pos], sensors->label[pos - 1], LABEL_LEN);
+		pos--;
+	}
+
+	return pos;
 }
 
 t_sensors *retrieve_sensors() {
-	t_sensors *sensors_head = NULL;
-	t_sensors *s = NULL;
-
-	char *path_input = NULL;
-	char *path_label = NULL;
-
-	const char *path_begin     = "/sys/devices/platform/applesmc.768/temp";
-	const char *path_end_input = "_input";
-	const char *path_end_label = "_label";
-
-	printf("Looking for temperature sensors under %s\n", path_begin);
-
-	int counter       = 1;
-	int sensors_found = 0;
-
-	for (counter = 1; counter < 68; counter++) {
-		printf("Checking temperature sensor temp%d\n", counter);
-
-		switch (counter) {
-			case 2:
-			case 4:
-			case 6:
-			case 7:
-			case 9:
-			case 11:
-			case 12:
-			case 14:
-			case 15:
-			case 17:
-			case 18:
-			case 20:
-			case 21:
-			case 23:
-			case 24:
-			case 25:
-			case 34:
-			case 42:
-			case 43:
-			case 44:
-			case 45:
-			case 46:
-			case 49:
-			case 50:
-			case 52:
-			case 53:
-			case 54:
-			case 55:
-			case 56:
-			case 57:
-			case 58:
-			case 59:
-			case 60:
-			case 61:
-			case 62:
-			case 63:
-			case 64:
-			case 68 : continue;
-		}
-
-		path_input = smprintf("%s%d%s", path_begin, counter, path_end_input);
-		path_label = smprintf("%s%d%s", path_begin, counter, path_end_label);
-
-		FILE *file_input = fopen(path_input, "r");
-		FILE *file_label = fopen(path_label, "r");
-
-		if (file_input != NULL) {
-			s = (t_sensors *) malloc(sizeof(t_sensors));
-
-			s->path_sensor_input = strdup(path_input);
-			s->path_sensor_label = strdup(path_label);
-
-			fscanf(file_input, "%d", &s->temperature);
-			fscanf(file_label, "%s", (char *) &s->label);
-
-			if (sensors_head == NULL) {
-				sensors_head = s;
-				sensors_head->next = NULL;
-			}
-			else {
-				t_sensors *tmp = sensors_head;
+	struct timespec time_start;
+	struct timespec time_end;
 
-				while (tmp->next != NULL) {
-					tmp = tmp->next;
-				}
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
 
-				tmp->next = s;
-				tmp->next->next = NULL;
-			}
+	printf("Looking for temperature sensors under %s\n", APPLESMC_PATH);
+
+	DIR *dir = opendir(APPLESMC_PATH);
+
+	if (dir == NULL) {
+		printf("ERROR: mbpfan could not open %s: %s\n", APPLESMC_PATH, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	t_sensors *sensors = (t_sensors *) calloc(1, sizeof(t_sensors));
+
+	char path[PATH_MAX];
+	struct dirent *entry;
+
+	// A single pass over the directory: only tempN_input entries are sensors
+	while ((entry = readdir(dir)) != NULL) {
+		unsigned int index = 0;
+		int consumed = 0;
 
-			s->file_input = file_input;
-			s->file_label = file_label;
+		if (sscanf(entry->d_name, "temp%u_input%n", &index, &consumed) != 1 || entry->d_name[consumed] != '\0' || consumed == 0) {
+			continue;
+		}
+
+		if (sensors->count == SENSORS_MAX) {
+			printf("Ignoring temperature sensor temp%u, table is full (%d sensors)\n", index, SENSORS_MAX);
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/temp%u_input", APPLESMC_PATH, index);
 
-			sensors_found++;
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+		if (fd == -1) {
+			continue;
 		}
 
-		free(path_input); path_input = NULL;
-		free(path_label); path_label = NULL;
+		unsigned int pos = sensor_slot(sensors, index);
+
+		sensors->fd[pos]          = fd;
+		sensors->index[pos]       = index;
+		sensors->temperature[pos] = 0;
+
+		sensors->read_errors[pos] = 0;
+		sysfs_read_int(fd, &sensors->temperature[pos]);
+
+		snprintf(path, sizeof(path), "%s/temp%u_label", APPLESMC_PATH, index);
+		read_label(path, sensors->label[pos]);
+
+		sensors->count++;
 	}
 
-	printf("Found %d temperature sensors\n", sensors_found);
+	closedir(dir);
+
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+	long elapsed_us = (time_end.tv_sec - time_start.tv_sec) * 1000000L + (time_end.tv_nsec - time_start.tv_nsec) / 1000L;
+
+	printf("Found %u temperature sensors in %ld.%03ld ms\n", sensors->count, elapsed_us / 1000, elapsed_us % 1000);
 
-	if (sensors_found == 0) {
+	if (sensors->count == 0) {
 		printf("ERROR: mbpfan could not detect any temperature sensors. Please contact the developer.\n");
 		exit(EXIT_FAILURE);
 	}
 
-	return sensors_head;
+	return sensors;
+}
+
+/* Make room for a fan in the table, keeping it ordered by index; return its position */
+static unsigned int fan_slot(t_fans *fans, unsigned int index) {
+	unsigned int pos = fans->count;
+
+	while (pos > 0 && fans->index[pos - 1] > index) {
+		fans->fd_output[pos]    = fans->fd_output[pos - 1];
+		fans->fd_input[pos]     = fans->fd_input[pos - 1];
+		fans->last_written[pos] = fans->last_written[pos - 1];
+		fans->min_speed[pos]    = fans->min_speed[pos - 1];
+		fans->max_speed[pos]    = fans->max_speed[pos - 1];
+		fans->index[pos]        = fans->index[pos - 1];
+		memcpy(fans->label[pos], fans->label[pos - 1], LABEL_LEN);
+		pos--;
+	}
+
+	return pos;
 }
 
 t_fans *retrieve_fans() {
-	t_fans *fans_head = NULL;
-	t_fans *fan = NULL;
+	char path[PATH_MAX];
+	struct dirent *entry;
 
-	char *path_output = NULL;
-	char *path_manual = NULL;
+	printf("Looking for fans under %s\n", APPLESMC_PATH);
 
-	const char *path_begin      = "/sys/devices/platform/applesmc.768/fan";
-	const char *path_end_output = "_output";
-	const char *path_end_manual = "_manual";
+	DIR *dir = opendir(APPLESMC_PATH);
 
-	printf("Looking for fans under %s\n", path_begin);
+	if (dir == NULL) {
+		printf("ERROR: mbpfan could not open %s: %s\n", APPLESMC_PATH, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 
-	int counter    = 1;
-	int fans_found = 0;
+	t_fans *fans = (t_fans *) calloc(1, sizeof(t_fans));
 
-	for (counter = 1; counter < 7; counter++) {
-		printf("Checking fan fan%d\n", counter);
+	// The same single pass as for sensors: fanN_output entries are fans mbpfan can drive
+	while ((entry = readdir(dir)) != NULL) {
+		unsigned int index = 0;
+		int consumed = 0;
 
-		path_output = smprintf("%s%d%s", path_begin, counter, path_end_output);
-		path_manual = smprintf("%s%d%s", path_begin, counter, path_end_manual);
+		if (sscanf(entry->d_name, "fan%u_output%n", &index, &consumed) != 1 || entry->d_name[consumed] != '\0' || consumed == 0) {
+			continue;
+		}
 
-		FILE *file_output = fopen(path_output, "w");
+		if (fans->count == FANS_MAX) {
+			printf("Ignoring fan fan%u, table is full (%d fans)\n", index, FANS_MAX);
+			continue;
+		}
 
-		if (file_output != NULL) {
-			fan = (t_fans *) malloc(sizeof(t_fans));
+		snprintf(path, sizeof(path), "%s/fan%u_output", APPLESMC_PATH, index);
 
-			fan->path_fan_output = strdup(path_output);
-			fan->path_fan_manual = strdup(path_manual);
+		int fd = open(path, O_WRONLY | O_CLOEXEC);
 
-			if (fans_head == NULL) {
-				fans_head = fan;
-				fans_head->next = NULL;
-			}
-			else {
-				t_fans *tmp = fans_head;
+		if (fd == -1) {
+			continue;
+		}
 
-				while (tmp->next != NULL) {
-					tmp = tmp->next;
-				}
+		unsigned int pos = fan_slot(fans, index);
 
-				tmp->next = fan;
-				tmp->next->next = NULL;
-			}
+		fans->fd_output[pos]    = fd;
+		fans->last_written[pos] = -1;
+		fans->index[pos]        = index;
+
+		snprintf(path, sizeof(path), "%s/fan%u_label", APPLESMC_PATH, index);
+		read_label(path, fans->label[pos]);
+
+		snprintf(path, sizeof(path), "%s/fan%u_input", APPLESMC_PATH, index);
+		fans->fd_input[pos] = open(path, O_RDONLY | O_CLOEXEC);
+
+		snprintf(path, sizeof(path), "%s/fan%u_min", APPLESMC_PATH, index);
+		fans->min_speed[pos] = read_attribute(path);
 
-			fan->file_output = file_output;
-			fans_found++;
+		snprintf(path, sizeof(path), "%s/fan%u_max", APPLESMC_PATH, index);
+		fans->max_speed[pos] = read_attribute(path);
+
+		if (fans->max_speed[pos] > fans->min_speed[pos]) {
+			printf("Fan fan%u runs from %d to %d RPM\n", index, fans->min_speed[pos], fans->max_speed[pos]);
+		}
+		else {
+			printf("Fan fan%u has no usable speed range, using min_fan_speed and max_fan_speed\n", index);
+			fans->min_speed[pos] = 0;
+			fans->max_speed[pos] = 0;
 		}
 
-		free(path_output); path_output = NULL;
-		free(path_manual); path_manual = NULL;
+		fans->count++;
 	}
 
-	printf("Found %d fans\n", fans_found);
+	closedir(dir);
+
+	printf("Found %u fans\n", fans->count);
 
-	if (fans_found == 0) {
+	if (fans->count == 0) {
 		printf("ERROR: mbpfan could not detect any fans. Please contact the developer.\n");
 		exit(EXIT_FAILURE);
 	}
 
-	return fans_head;
+	return fans;
 }
 
+void free_sensors(t_sensors *sensors) {
+	if (sensors == NULL) {
+		return;
+	}
 
-static void set_fans_mode(t_fans *fans, int mode) {
-	t_fans *tmp = fans;
-	FILE *file;
+	unsigned int i;
+
+	for (i = 0; i < sensors->count; i++) {
+		close(sensors->fd[i]);
+	}
+
+	free(sensors);
+}
+
+void free_fans(t_fans *fans) {
+	if (fans == NULL) {
+		return;
+	}
 
-	printf("Setting fans to manual control\n");
+	unsigned int i;
 
-	while (tmp != NULL) {
-		file = fopen(tmp->path_fan_manual, "rw+");
+	for (i = 0; i < fans->count; i++) {
+		close(fans->fd_output[i]);
 
-		if (file != NULL) {
-			fprintf(file, "%d", mode);
-			fclose(file);
+		if (fans->fd_input[i] != -1) {
+			close(fans->fd_input[i]);
 		}
+	}
+
+	free(fans);
+}
+
+
+static void set_fan_mode(t_fans *fans, unsigned int i, int mode) {
+	char path[PATH_MAX];
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/fan%u_manual", APPLESMC_PATH, fans->index[i]);
+	file = fopen(path, "rw+");
 
-		tmp = tmp->next;
+	if (file != NULL) {
+		fprintf(file, "%d", mode);
+		fclose(file);
+	}
+
+	// The SMC may have changed the speed behind our back
+	fans->last_written[i] = -1;
+	fans->off_target[i]   = 0;
+}
+
+static void set_fans_mode(t_fans *fans, int mode) {
+	unsigned int i;
+
+	printf("Setting fans to %s control\n", mode == 1 ? "manual" : "automatic");
+
+	for (i = 0; i < fans->count; i++) {
+		set_fan_mode(fans, i, mode);
 	}
 }
 
@@ -275,191 +448,1494 @@ void set_fans_auto(t_fans *fans) {
 }
 
 
+void sensor_read_failed(t_sensors *sensors, unsigned int i, int error) {
+	sensors->read_errors[i]++;
+
+	if (sensors->read_errors[i] % 100 == 1) {
+		printf("ERROR: could not read temperature sensor temp%u (%u errors): %s\n", sensors->index[i], sensors->read_errors[i], strerror(-error));
+	}
+}
+
 t_sensors *refresh_sensors(t_sensors *sensors) {
-	t_sensors *tmp = sensors;
+	struct timespec time_start;
+	struct timespec time_end;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+	if (uring_active()) {
+		sensors->sample_syscalls = uring_refresh(sensors);
+	}
+	else if (pool_active()) {
+		// A prefetch may already have started the batch
+		pool_start();
+		pool_wait();
+
+		sensors->sample_syscalls = sensors->count;
+	}
+	else {
+		for (i = 0; i < sensors->count; i++) {
+			int result = sensor_read(sensors->fd[i], &sensors->temperature[i]);
 
-	while (tmp != NULL) {
-		if (tmp->file_input != NULL) {
-			char buf[16];
-			int len = pread(fileno(tmp->file_input), buf, sizeof(buf), /*offset=*/ 0);
-			buf[len] = '\0';
-			sscanf(buf, "%d", &tmp->temperature);
+			// On failure the previous sample is kept
+			if (result != 0) {
+				sensor_read_failed(sensors, i, result);
+			}
 		}
 
-		tmp = tmp->next;
+		sensors->sample_syscalls = sensors->count;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+	sensors->sample_ns = (time_end.tv_sec - time_start.tv_sec) * 1000000000L + (time_end.tv_nsec - time_start.tv_nsec);
+
 	return sensors;
 }
 
 
+/* Map a speed between min_fan_speed and max_fan_speed onto the range of fan i */
+int fan_target_speed(const t_fans *fans, unsigned int i, int speed) {
+	int fan_min = fans->min_speed[i];
+	int fan_max = fans->max_speed[i];
+
+	if (fan_max <= fan_min) {
+		return speed;
+	}
+
+	long long target = fan_max;
+
+	if (max_fan_speed > min_fan_speed) {
+		target = fan_min + (long long)(speed - min_fan_speed) * (fan_max - fan_min) / (max_fan_speed - min_fan_speed);
+	}
+
+	return (int) min(max(target, fan_min), fan_max);
+}
+
+/* Controls the speed of fan i */
+static void write_fan_speed(t_fans *fans, unsigned int i, int speed) {
+	// Always let the speed reach its bounds, even within the deadband
+	int bound  = speed <= min_fan_speed || speed >= max_fan_speed;
+	int target = fan_target_speed(fans, i, speed);
+	int last   = fans->last_written[i];
+
+	// Every write is an SMC transaction: skip those that change nothing
+	if (last == target || (last >= 0 && !bound && abs(target - last) <= fan_speed_deadband)) {
+		fans->writes_suppressed++;
+		return;
+	}
+
+	fans->writes_issued++;
+
+	if (sysfs_write_int(fans->fd_output[i], target) == 0) {
+		fans->last_written[i] = target;
+	}
+	else {
+		fans->last_written[i] = -1;
+	}
+}
+
 /* Controls the speed of the fan */
 void set_fan_speed(t_fans* fans, int speed) {
-	t_fans *tmp = fans;
+	unsigned int i;
+
+	for (i = 0; i < fans->count; i++) {
+		write_fan_speed(fans, i, speed);
+	}
+}
+
+void set_fan_speeds(t_fans *fans, const int *speeds) {
+	unsigned int i;
+
+	for (i = 0; i < fans->count; i++) {
+		write_fan_speed(fans, i, speeds[i]);
+	}
+}
+
+void check_fans(t_fans *fans) {
+	char path[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < fans->count; i++) {
+		int commanded = fans->last_written[i];
+
+		if (fans->fd_input[i] == -1 || commanded < 0 || sysfs_read_int(fans->fd_input[i], &fans->measured[i]) != 0) {
+			continue;
+		}
+
+		if (abs(commanded - fans->measured[i]) <= tach_tolerance) {
+			fans->off_target[i] = 0;
+			continue;
+		}
+
+		// Fans need a few checks to spin up or down, report each episode once
+		if (++fans->off_target[i] != (unsigned int) tach_checks) {
+			continue;
+		}
 
-	while (tmp != NULL) {
-		if (tmp->file_output != NULL) {
-			char buf[16];
-			int len = snprintf(buf, sizeof(buf), "%d", speed);
-			pwrite(fileno(tmp->file_output), buf, len, /*offset=*/ 0);
+		if (fans->measured[i] == 0 && commanded > 0) {
+			fans->stalls[i]++;
+			printf("ERROR: fan%u stalled: set to %d RPM but not spinning (%u stalls)\n", fans->index[i], commanded, fans->stalls[i]);
+		}
+		else {
+			fans->lags[i]++;
+			printf("WARNING: fan%u lags: set to %d RPM but spinning at %d RPM (%u times)\n", fans->index[i], commanded, fans->measured[i], fans->lags[i]);
 		}
 
-		tmp = tmp->next;
+		// After some firmware events the SMC silently takes the fans back
+		snprintf(path, sizeof(path), "%s/fan%u_manual", APPLESMC_PATH, fans->index[i]);
+
+		if (read_attribute(path) == 0) {
+			fans->mode_reasserts[i]++;
+			printf("Fan fan%u fell back to automatic control, setting it to manual again (%u times)\n", fans->index[i], fans->mode_reasserts[i]);
+			set_fan_mode(fans, i, 1);
+		}
 	}
 }
 
-unsigned short get_temp(t_sensors* sensors) {
+int get_temp(t_sensors* sensors) {
+	sensors = refresh_sensors(sensors);
+
+	return aggregate_temp(&aggregation, sensors->temperature, sensors->count);
+}
+
+int get_predicted_temp(t_sensors* sensors, int dt_ms) {
+	if (!temp_estimator) {
+		return get_temp(sensors);
+	}
+
 	sensors = refresh_sensors(sensors);
-	int sum_temp = 0;
-	unsigned short temp = 0;
+	estimator_update(&estimator, sensors->temperature, sensors->count, dt_ms);
+
+	return aggregate_temp(&aggregation, estimator.predicted, sensors->count);
+}
+
 
-	t_sensors* tmp = sensors;
+/* Read a single word setting, without trailing comment or blanks
+ * Return TRUE if the key is present and not empty
+ */
+static int settings_get_word(const Settings *settings, const char *section, const char *key, char *out_buf, unsigned int n_out_buf) {
+	if (!settings_get(settings, section, key, out_buf, n_out_buf)) {
+		return 0;
+	}
 
-	int number_sensors = 0;
+	char *end = strchr(out_buf, '#');
 
-	while (tmp != NULL) {
-		sum_temp += tmp->temperature;
-		tmp = tmp->next;
-		number_sensors++;
+	if (end == NULL) {
+		end = out_buf + strlen(out_buf);
 	}
 
-	// Just to be safe
-	if (number_sensors == 0) {
-		number_sensors++;
+	while (end > out_buf && (end[-1] == ' ' || end[-1] == '\t')) {
+		end--;
 	}
 
-	temp = (unsigned short)( ceil( (float)( sum_temp ) / (number_sensors * 1000) ) );
-	return temp;
+	*end = '\0';
+
+	return out_buf[0] != '\0';
 }
 
+/* Read a number setting, keeping the current value if the key is missing */
+static void retrieve_double(const Settings *settings, const char *section, const char *key, double *out) {
+	char value[256];
 
-void retrieve_settings(const char* settings_path) {
-	Settings *settings = NULL;
+	if (settings_get_word(settings, section, key, value, sizeof(value))) {
+		*out = atof(value);
+	}
+}
+
+/* Read the aggregation settings of a section, keeping what is not set */
+static void retrieve_aggregation(const Settings *settings, const char *section, t_aggregation *agg) {
+	char value[256];
 	int result = 0;
-	FILE *f = NULL;
 
-	if (settings_path == NULL) {
-		f = fopen("/etc/mbpfan.conf", "r");
+	if (settings_get_word(settings, section, "aggregation", value, sizeof(value))) {
+		if (!aggregation_parse_method(value, &agg->method)) {
+			printf("Unknown aggregation '%s', using %s\n", value, aggregation_method_name(agg->method));
+		}
 	}
-	else {
-		f = fopen(settings_path, "r");
+
+	result = settings_get_int(settings, section, "aggregation_k");
+	if (result > 0) { agg->k = result; }
+
+	result = settings_get_int(settings, section, "aggregation_percentile");
+	if (result > 0 && result <= 100) { agg->percentile = result; }
+
+	if (settings_get_word(settings, section, "sensor_weights", value, sizeof(value))) {
+		aggregation_parse_weights(agg, value);
 	}
+}
 
-	if (f == NULL) {
-		/* Could not open configfile */
-		printf("Couldn't open configfile, using defaults\n");
+
+/* Everything retrieve_settings() reads, staged and validated as a whole
+ * before it replaces the running settings, with what derives from it */
+struct s_config {
+	int min_fan_speed;
+	int max_fan_speed;
+	int low_temp;
+	int high_temp;
+	int max_temp;
+
+	int polling_interval_ms;
+	int adaptive_polling;
+	int polling_interval_min_ms;
+	int polling_interval_max_ms;
+	int adaptive_rise_rate;
+	int adaptive_stable_rate;
+
+	int use_io_uring;
+	int sensor_workers;
+	int sensor_prefetch_ms;
+
+	int watch_config;
+	int control_socket;
+	int shared_telemetry;
+	char metrics_textfile[PATH_MAX];
+	char history_file[PATH_MAX];
+	int  history_max_size;
+	int  history_files;
+
+	int fan_speed_deadband;
+	int tach_feedback;
+	int tach_tolerance;
+	int tach_checks;
+
+	int    control_mode;
+	double pid_setpoint;
+	double pid_kp;
+	double pid_ki;
+	double pid_kd;
+	double pid_filter;
+
+	int    temp_estimator;
+	double estimator_alpha;
+	double estimator_beta;
+	double prediction_horizon;
+
+	t_aggregation  aggregation;
+	t_curve_points curve_points;
+
+	unsigned int zone_count;
+	t_zone       zones[ZONES_MAX];
+
+	t_curve curve;  // derived from curve_points, or from the triangle
+};
+
+typedef struct s_config t_config;
+
+/* The next settings, too large for the stack */
+static t_config staged;
+
+/* FALSE until the first settings were published */
+static int published = 0;
+
+/* The triangle of the [general] settings, temperatures in millidegrees */
+static t_curve_triangle config_triangle(const t_config *c) {
+	t_curve_triangle triangle = {
+		.min_speed = c->min_fan_speed,
+		.max_speed = c->max_fan_speed,
+		.low_temp  = c->low_temp * 1000,
+		.high_temp = c->high_temp * 1000,
+		.max_temp  = c->max_temp * 1000,
+	};
+
+	return triangle;
+}
+
+/* The triangle of the running settings */
+static t_curve_triangle settings_triangle() {
+	t_curve_triangle triangle = {
+		.min_speed = min_fan_speed,
+		.max_speed = max_fan_speed,
+		.low_temp  = low_temp * 1000,
+		.high_temp = high_temp * 1000,
+		.max_temp  = max_temp * 1000,
+	};
+
+	return triangle;
+}
+
+/* Materialize points, or the triangle when there are none, into a curve */
+static void curve_from(t_curve *curve, const t_curve_points *points, const t_curve_triangle *triangle) {
+	if (points->count > 0) {
+		// A configured curve is followed the same way up and down
+		curve_build(curve, points->temp[0], points->temp[points->count - 1], curve_points_speed, curve_points_speed, points);
 	}
 	else {
-		settings = settings_open(f);
-		fclose(f);
+		curve_build(curve, triangle->low_temp, triangle->max_temp, curve_triangle_up, curve_triangle_down, triangle);
+	}
+}
 
-		if (settings == NULL) {
-			/* Could not read configfile */
-			printf("Couldn't read configfile\n");
-		}
-		else {
-			printf("Read config file at /etc/mbpfan.conf\n");
+/* Number of elements of a comma separated tuple */
+static unsigned int tuple_length(const char *value) {
+	unsigned int count = 1;
 
-			/* Read configfile values */
-			result = settings_get_int(settings, "general", "min_fan_speed");
-			if (result != 0) { min_fan_speed = result; }
+	for (; *value != '\0'; value++) {
+		count += *value == ',';
+	}
 
-			result = settings_get_int(settings, "general", "max_fan_speed");
-			if (result != 0) { max_fan_speed = result; }
+	return count;
+}
 
-			result = settings_get_int(settings, "general", "low_temp");
-			if (result != 0) { low_temp = result; }
+/* Read the curve points of a section, speeds are clamped to the range of c
+ * Return TRUE if the section holds no curve or a valid one
+ */
+static int retrieve_curve(const Settings *settings, const char *section, const t_config *c, t_curve_points *points) {
+	char temps_value[256];
+	char speeds_value[256];
+	char value[256];
+	double temps[CURVE_POINTS_MAX];
+	unsigned int count;
+	unsigned int i;
+
+	points->count = 0;
+
+	if (!settings_get_word(settings, section, "temps", temps_value, sizeof(temps_value))) {
+		return 1;
+	}
 
-			result = settings_get_int(settings, "general", "high_temp");
-			if (result != 0) { high_temp = result; }
+	if (!settings_get_word(settings, section, "speeds", speeds_value, sizeof(speeds_value))) {
+		printf("Curve of [%s] has temps but no speeds\n", section);
+		return 0;
+	}
 
-			result = settings_get_int(settings, "general", "max_temp");
-			if (result != 0) { max_temp = result; }
+	count = tuple_length(temps_value);
 
-			result = settings_get_int(settings, "general", "polling_interval");
-			if (result != 0) { polling_interval = result; }
+	if (count != tuple_length(speeds_value)) {
+		printf("Curve of [%s] has %u temps but %u speeds\n", section, count, tuple_length(speeds_value));
+		return 0;
+	}
 
-			/* Destroy the settings object */
-			settings_delete(settings);
+	if (count < 2 || count > CURVE_POINTS_MAX) {
+		printf("Curve of [%s] needs 2 to %d points\n", section, CURVE_POINTS_MAX);
+		return 0;
+	}
+
+	settings_get_double_tuple(settings, section, "temps", temps, count);
+	settings_get_int_tuple(settings, section, "speeds", points->speed, count);
+
+	for (i = 0; i < count; i++) {
+		points->temp[i]  = (int) lround(temps[i] * 1000);
+		points->speed[i] = max(min(points->speed[i], c->max_fan_speed), c->min_fan_speed);
+	}
+
+	points->interpolation = CURVE_LINEAR;
+
+	if (settings_get_word(settings, section, "interpolation", value, sizeof(value))) {
+		if (strcmp(value, "cubic") == 0) {
+			points->interpolation = CURVE_CUBIC;
 		}
+		else if (strcmp(value, "linear") != 0) {
+			printf("Unknown curve interpolation '%s' in [%s], using linear\n", value, section);
+		}
+	}
+
+	if (!curve_points_prepare(points, count)) {
+		printf("Curve temps of [%s] must be increasing\n", section);
+		points->count = 0;
+		return 0;
+	}
+
+	if (points->temp[count - 1] - points->temp[0] > (CURVE_ENTRIES_MAX - 1) * CURVE_RESOLUTION) {
+		printf("Curve of [%s] spans more than %d degrees\n", section, (CURVE_ENTRIES_MAX - 1) * CURVE_RESOLUTION / 1000);
+		points->count = 0;
+		return 0;
 	}
+
+	return 1;
 }
 
 
-void mbpfan() {
-	int old_temp  = 0;
-	int new_temp  = 0;
-	int fan_speed = 0;
-	int steps     = 0;
+/* Read the [zone:NAME] sections listed by zones, each starting from the
+ * [general] aggregation and triangle
+ * Return FALSE if a zone is incomplete or invalid
+ */
+static int retrieve_zones(const Settings *settings, t_config *c) {
+	char names[256];
+	char section[ZONE_NAME_LEN + 8];
+	const char *name;
+	int result = 0;
 
-	int temp_change = 0;
+	c->zone_count = 0;
 
-	int step_up   = 0;
-	int step_down = 0;
+	if (!settings_get_word(settings, "general", "zones", names, sizeof(names))) {
+		return 1;
+	}
 
-	retrieve_settings(NULL);
+	for (name = strtok(names, ", \t"); name != NULL; name = strtok(NULL, ", \t")) {
+		if (c->zone_count == ZONES_MAX) {
+			printf("Only %d zones are supported\n", ZONES_MAX);
+			return 0;
+		}
 
-	printf("Retrieving sensors\n");
-	sensors = retrieve_sensors();
+		t_zone *zone = &c->zones[c->zone_count];
 
-	printf("Retrieving fans\n");
-	fans = retrieve_fans();
+		snprintf(zone->name, sizeof(zone->name), "%s", name);
+		snprintf(section, sizeof(section), "zone:%s", zone->name);
 
-	set_fans_man(fans);
+		if (!settings_get_word(settings, section, "sensors", zone->sensors_spec, sizeof(zone->sensors_spec))
+				|| !settings_get_word(settings, section, "fans", zone->fans_spec, sizeof(zone->fans_spec))) {
+			printf("Zone %s needs sensors and fans in [%s]\n", zone->name, section);
+			return 0;
+		}
 
-	new_temp = get_temp(sensors);
+		zone->aggregation = c->aggregation;
+		retrieve_aggregation(settings, section, &zone->aggregation);
 
-	fan_speed = min_fan_speed;
-	set_fan_speed(fans, fan_speed);
+		zone->triangle = config_triangle(c);
 
-	printf("Polling interval set to %d seconds\n", polling_interval);
+		result = settings_get_int(settings, section, "low_temp");
+		if (result != 0) { zone->triangle.low_temp = result * 1000; }
 
-	printf("Sleeping for %d seconds to get first temp delta\n", polling_interval);
+		result = settings_get_int(settings, section, "high_temp");
+		if (result != 0) { zone->triangle.high_temp = result * 1000; }
 
-	sleep(polling_interval);
+		result = settings_get_int(settings, section, "max_temp");
+		if (result != 0) { zone->triangle.max_temp = result * 1000; }
 
-	step_up   = (float)(max_fan_speed - min_fan_speed) / (float)( (max_temp - high_temp) * (max_temp - high_temp + 1) / 2 );
-	step_down = (float)(max_fan_speed - min_fan_speed) / (float)( (max_temp - low_temp)  * (max_temp - low_temp + 1)  / 2 );
+		if (!(zone->triangle.low_temp < zone->triangle.high_temp && zone->triangle.high_temp < zone->triangle.max_temp)) {
+			printf("Zone %s needs low_temp < high_temp < max_temp\n", zone->name);
+			return 0;
+		}
 
-	printf("Max temp  : %d\n", max_temp);
-	printf("High temp : %d\n", high_temp);
-	printf("Low temp  : %d\n", low_temp);
+		if (!retrieve_curve(settings, section, c, &zone->points)) {
+			return 0;
+		}
 
-	printf("Step up   : %d\n", step_up);
-	printf("Step down : %d\n", step_down);
+		c->zone_count++;
+	}
 
-	while (1) {
-		old_temp    = new_temp;
-		new_temp    = get_temp(sensors);
-		temp_change = new_temp - old_temp;
+	return 1;
+}
 
-		if (new_temp >= max_temp) {
-			fan_speed = max_fan_speed;
+/* Resolve zones against the sensor and fan tables */
+static void bind_zones(t_zone *zones, unsigned int count) {
+	unsigned int z;
+
+	for (z = 0; z < count; z++) {
+		if (zone_bind(&zones[z], sensors, fans)) {
+			printf("Zone %s: %u sensors, %u fans\n", zones[z].name, zones[z].sensor_count, zones[z].fan_count);
 		}
 		else {
-			if (new_temp <= low_temp) {
-				fan_speed = min_fan_speed;
-			}
-			else {
-				if (temp_change >= 0 && new_temp > high_temp && new_temp < max_temp) {
-					steps     = ( new_temp - high_temp ) * ( new_temp - high_temp + 1 ) / 2;
-					fan_speed = max( fan_speed, ceil(min_fan_speed + steps * step_up) );
-				}
-				else {
-					if (temp_change < 0 && new_temp > low_temp && new_temp < max_temp) {
-						steps     = ( max_temp - new_temp ) * ( max_temp - new_temp + 1 ) / 2;
-						fan_speed = min( fan_speed, floor(max_fan_speed - steps * step_down) );
-					}
-				}
-			}
+			printf("Zone %s selects no sensor or no fan, ignoring it\n", zones[z].name);
 		}
+	}
+}
+
+/* Copy the running settings, so that keys missing from the file keep them */
+static void config_capture(t_config *c) {
+	c->min_fan_speed           = min_fan_speed;
+	c->max_fan_speed           = max_fan_speed;
+	c->low_temp                = low_temp;
+	c->high_temp               = high_temp;
+	c->max_temp                = max_temp;
+	c->polling_interval_ms     = polling_interval_ms;
+	c->adaptive_polling        = adaptive_polling;
+	c->polling_interval_min_ms = polling_interval_min_ms;
+	c->polling_interval_max_ms = polling_interval_max_ms;
+	c->adaptive_rise_rate      = adaptive_rise_rate;
+	c->adaptive_stable_rate    = adaptive_stable_rate;
+	c->use_io_uring            = use_io_uring;
+	c->sensor_workers          = sensor_workers;
+	c->sensor_prefetch_ms      = sensor_prefetch_ms;
+	c->watch_config            = watch_config;
+	c->control_socket          = control_socket;
+	c->shared_telemetry        = shared_telemetry;
+	memcpy(c->metrics_textfile, metrics_textfile, sizeof(metrics_textfile));
+	memcpy(c->history_file, history_file, sizeof(history_file));
+	c->history_max_size        = history_max_size;
+	c->history_files           = history_files;
+	c->fan_speed_deadband      = fan_speed_deadband;
+	c->tach_feedback           = tach_feedback;
+	c->tach_tolerance          = tach_tolerance;
+	c->tach_checks             = tach_checks;
+	c->control_mode            = control_mode;
+	c->pid_setpoint            = pid_setpoint;
+	c->pid_kp                  = pid_kp;
+	c->pid_ki                  = pid_ki;
+	c->pid_kd                  = pid_kd;
+	c->pid_filter              = pid_filter;
+	c->temp_estimator          = temp_estimator;
+	c->estimator_alpha         = estimator_alpha;
+	c->estimator_beta          = estimator_beta;
+	c->prediction_horizon      = prediction_horizon;
+	c->aggregation             = aggregation;
+	c->curve_points            = curve_points;
+	c->zone_count              = zone_count;
+	memcpy(c->zones, zones, sizeof(zones));
+}
+
+/* Read the settings of a file over c
+ * Return FALSE if a section is invalid
+ */
+static int config_parse(const Settings *settings, t_config *c) {
+	char value[256];
+	int result = 0;
 
-		printf("Old: %d, new: %d, change: %d, speed: %d, steps: %d\n", old_temp, new_temp, temp_change, fan_speed, steps);
+	result = settings_get_int(settings, "general", "min_fan_speed");
+	if (result != 0) { c->min_fan_speed = result; }
 
-		set_fan_speed(fans, fan_speed);
+	result = settings_get_int(settings, "general", "max_fan_speed");
+	if (result != 0) { c->max_fan_speed = result; }
 
-		fflush(stdout);
+	result = settings_get_int(settings, "general", "low_temp");
+	if (result != 0) { c->low_temp = result; }
 
-		sleep(polling_interval);
-	}
+	result = settings_get_int(settings, "general", "high_temp");
+	if (result != 0) { c->high_temp = result; }
+
+	result = settings_get_int(settings, "general", "max_temp");
+	if (result != 0) { c->max_temp = result; }
+
+	double interval = 0;
+	retrieve_double(settings, "general", "polling_interval", &interval);
+	if (interval > 0) { c->polling_interval_ms = max((int)(interval * 1000 + 0.5), 1); }
+
+	c->adaptive_polling = settings_get_int(settings, "general", "adaptive_polling");
+
+	interval = 0;
+	retrieve_double(settings, "general", "polling_interval_min", &interval);
+	if (interval > 0) { c->polling_interval_min_ms = max((int)(interval * 1000 + 0.5), 1); }
+
+	interval = 0;
+	retrieve_double(settings, "general", "polling_interval_max", &interval);
+	if (interval > 0) { c->polling_interval_max_ms = max((int)(interval * 1000 + 0.5), 1); }
+
+	double rate = 0;
+	retrieve_double(settings, "general", "adaptive_rise_rate", &rate);
+	if (rate > 0) { c->adaptive_rise_rate = (int)(rate * 1000); }
+
+	rate = 0;
+	retrieve_double(settings, "general", "adaptive_stable_rate", &rate);
+	if (rate > 0) { c->adaptive_stable_rate = (int)(rate * 1000); }
+
+	c->use_io_uring = settings_get_int(settings, "general", "io_uring");
+
+	c->watch_config = settings_get_int(settings, "general", "watch_config");
+
+	c->control_socket = settings_get_int(settings, "general", "control_socket");
+
+	c->shared_telemetry = settings_get_int(settings, "general", "shared_telemetry");
+
+	if (!settings_get_word(settings, "general", "metrics_textfile", c->metrics_textfile, sizeof(c->metrics_textfile))) {
+		c->metrics_textfile[0] = '\0';
+	}
+
+	if (!settings_get_word(settings, "general", "history_file", c->history_file, sizeof(c->history_file))) {
+		c->history_file[0] = '\0';
+	}
+
+	result = settings_get_int(settings, "general", "history_max_size");
+	if (result != 0) { c->history_max_size = result; }
+
+	result = settings_get_int(settings, "general", "history_files");
+	if (result != 0) { c->history_files = result; }
+
+	c->fan_speed_deadband = settings_get_int(settings, "general", "fan_speed_deadband");
+
+	c->tach_feedback = settings_get_int(settings, "general", "tach_feedback");
+
+	result = settings_get_int(settings, "general", "tach_tolerance");
+	if (result != 0) { c->tach_tolerance = result; }
+
+	result = settings_get_int(settings, "general", "tach_checks");
+	if (result != 0) { c->tach_checks = result; }
+
+	c->sensor_workers     = settings_get_int(settings, "general", "sensor_workers");
+	c->sensor_prefetch_ms = settings_get_int(settings, "general", "sensor_prefetch_ms");
+
+	retrieve_aggregation(settings, "general", &c->aggregation);
+
+	if (settings_get_word(settings, "general", "control_mode", value, sizeof(value))) {
+		if (strcmp(value, "pid") == 0) {
+			c->control_mode = CONTROL_PID;
+		}
+		else if (strcmp(value, "triangle") == 0) {
+			c->control_mode = CONTROL_TRIANGLE;
+		}
+		else {
+			printf("Unknown control_mode '%s'\n", value);
+			return 0;
+		}
+	}
+
+	retrieve_double(settings, "general", "pid_setpoint", &c->pid_setpoint);
+	retrieve_double(settings, "general", "pid_kp", &c->pid_kp);
+	retrieve_double(settings, "general", "pid_ki", &c->pid_ki);
+	retrieve_double(settings, "general", "pid_kd", &c->pid_kd);
+	retrieve_double(settings, "general", "pid_filter", &c->pid_filter);
+
+	c->temp_estimator = settings_get_int(settings, "general", "estimator");
+	retrieve_double(settings, "general", "estimator_alpha", &c->estimator_alpha);
+	retrieve_double(settings, "general", "estimator_beta", &c->estimator_beta);
+	retrieve_double(settings, "general", "prediction_horizon", &c->prediction_horizon);
+
+	return retrieve_curve(settings, "curve", c, &c->curve_points) && retrieve_zones(settings, c);
+}
+
+/* Check the settings as a whole, printing what is wrong
+ * Return TRUE if they are usable
+ */
+static int config_validate(const t_config *c) {
+	int valid = 1;
+
+	if (c->min_fan_speed < 0 || c->max_fan_speed <= c->min_fan_speed) {
+		printf("Invalid settings: need 0 <= min_fan_speed < max_fan_speed, got %d and %d\n", c->min_fan_speed, c->max_fan_speed);
+		valid = 0;
+	}
+
+	if (!(c->low_temp < c->high_temp && c->high_temp < c->max_temp)) {
+		printf("Invalid settings: need low_temp < high_temp < max_temp, got %d, %d and %d\n", c->low_temp, c->high_temp, c->max_temp);
+		valid = 0;
+	}
+
+	if (c->adaptive_polling && c->polling_interval_min_ms > c->polling_interval_max_ms) {
+		printf("Invalid settings: polling_interval_min is above polling_interval_max\n");
+		valid = 0;
+	}
+
+	if (c->history_max_size <= 0 || c->history_files < 0) {
+		printf("Invalid settings: need history_max_size > 0 and history_files >= 0\n");
+		valid = 0;
+	}
+
+	if (c->fan_speed_deadband < 0 || c->tach_tolerance < 0 || c->tach_checks < 0 || c->sensor_workers < 0 || c->sensor_prefetch_ms < 0) {
+		printf("Invalid settings: fan_speed_deadband, tach_tolerance, tach_checks, sensor_workers and sensor_prefetch_ms cannot be negative\n");
+		valid = 0;
+	}
+
+	if (c->pid_kp < 0 || c->pid_ki < 0 || c->pid_kd < 0 || c->pid_filter < 0) {
+		printf("Invalid settings: pid gains and pid_filter cannot be negative\n");
+		valid = 0;
+	}
+
+	if (c->estimator_alpha <= 0 || c->estimator_alpha > 1 || c->estimator_beta < 0 || c->estimator_beta > 1 || c->prediction_horizon < 0) {
+		printf("Invalid settings: need 0 < estimator_alpha <= 1, 0 <= estimator_beta <= 1 and prediction_horizon >= 0\n");
+		valid = 0;
+	}
+
+	return valid;
+}
+
+/* Compute what derives from the settings, before they run */
+static void config_derive(t_config *c) {
+	unsigned int z;
+	t_curve_triangle triangle = config_triangle(c);
+
+	curve_from(&c->curve, &c->curve_points, &triangle);
+
+	for (z = 0; z < c->zone_count; z++) {
+		zone_build(&c->zones[z]);
+	}
+
+	if (sensors != NULL) {
+		aggregation_bind(&c->aggregation, sensors);
+	}
+
+	if (sensors != NULL && fans != NULL) {
+		bind_zones(c->zones, c->zone_count);
+	}
+}
+
+/* Make staged settings the running ones, all in one go between two ticks */
+static void config_publish(const t_config *c) {
+	min_fan_speed           = c->min_fan_speed;
+	max_fan_speed           = c->max_fan_speed;
+	low_temp                = c->low_temp;
+	high_temp               = c->high_temp;
+	max_temp                = c->max_temp;
+	polling_interval_ms     = c->polling_interval_ms;
+	adaptive_polling        = c->adaptive_polling;
+	polling_interval_min_ms = c->polling_interval_min_ms;
+	polling_interval_max_ms = c->polling_interval_max_ms;
+	adaptive_rise_rate      = c->adaptive_rise_rate;
+	adaptive_stable_rate    = c->adaptive_stable_rate;
+	use_io_uring            = c->use_io_uring;
+	sensor_workers          = c->sensor_workers;
+	sensor_prefetch_ms      = c->sensor_prefetch_ms;
+	watch_config            = c->watch_config;
+	control_socket          = c->control_socket;
+	shared_telemetry        = c->shared_telemetry;
+	memcpy(metrics_textfile, c->metrics_textfile, sizeof(metrics_textfile));
+	memcpy(history_file, c->history_file, sizeof(history_file));
+	history_max_size        = c->history_max_size;
+	history_files           = c->history_files;
+	fan_speed_deadband      = c->fan_speed_deadband;
+	tach_feedback           = c->tach_feedback;
+	tach_tolerance          = c->tach_tolerance;
+	tach_checks             = c->tach_checks;
+	control_mode            = c->control_mode;
+	pid_setpoint            = c->pid_setpoint;
+	pid_kp                  = c->pid_kp;
+	pid_ki                  = c->pid_ki;
+	pid_kd                  = c->pid_kd;
+	pid_filter              = c->pid_filter;
+	temp_estimator          = c->temp_estimator;
+	estimator_alpha         = c->estimator_alpha;
+	estimator_beta          = c->estimator_beta;
+	prediction_horizon      = c->prediction_horizon;
+	aggregation             = c->aggregation;
+	curve_points            = c->curve_points;
+	curve                   = c->curve;
+	zone_count              = c->zone_count;
+	memcpy(zones, c->zones, sizeof(zones));
+
+	int setpoint = pid_setpoint > 0 ? (int)(pid_setpoint * 1000) : high_temp * 1000;
+	pid_configure(&pid, setpoint, pid_kp, pid_ki, pid_kd, pid_filter, min_fan_speed, max_fan_speed);
+
+	estimator_configure(&estimator, estimator_alpha, estimator_beta, prediction_horizon);
+
+	// Estimates left over from before it was turned off are stale
+	if (!temp_estimator) {
+		estimator_reset(&estimator);
+	}
+
+	published = 1;
+}
+
+
+int retrieve_settings(const char* settings_path) {
+	Settings *settings = NULL;
+	FILE *f = NULL;
+	int valid = 1;
+
+	if (settings_path == NULL) {
+		settings_path = SETTINGS_PATH;
+	}
+
+	config_capture(&staged);
+
+	f = fopen(settings_path, "r");
+
+	if (f == NULL) {
+		/* Could not open configfile */
+		printf("Couldn't open configfile, using defaults\n");
+	}
+	else {
+		settings = settings_open(f);
+		fclose(f);
+
+		if (settings == NULL) {
+			/* Could not read configfile */
+			printf("Couldn't read configfile\n");
+		}
+		else {
+			printf("Read config file at %s\n", settings_path);
+
+			valid = config_parse(settings, &staged) && config_validate(&staged);
+
+			/* Destroy the settings object */
+			settings_delete(settings);
+		}
+	}
+
+	if (!valid) {
+		printf("Rejected the settings in %s, keeping the running ones\n", settings_path);
+
+		// Nothing runs yet the very first time: the defaults will
+		if (published) {
+			return 0;
+		}
+
+		config_capture(&staged);
+	}
+
+	config_derive(&staged);
+	config_publish(&staged);
+	return valid;
+}
+
+int retrieve_history_file(const char *settings_path, char *out_buf, unsigned int n_out_buf) {
+	Settings *settings = NULL;
+	FILE *f = NULL;
+	int found;
+
+	if (settings_path == NULL) {
+		settings_path = SETTINGS_PATH;
+	}
+
+	f = fopen(settings_path, "r");
+
+	if (f == NULL) {
+		return 0;
+	}
+
+	settings = settings_open(f);
+	fclose(f);
+
+	if (settings == NULL) {
+		return 0;
+	}
+
+	found = settings_get_word(settings, "general", "history_file", out_buf, n_out_buf);
+	settings_delete(settings);
+
+	return found;
+}
+
+
+int curve_speed_up(int temp) {
+	t_curve_triangle triangle = settings_triangle();
+	return curve_triangle_up(&triangle, temp);
+}
+
+int curve_speed_down(int temp) {
+	t_curve_triangle triangle = settings_triangle();
+	return curve_triangle_down(&triangle, temp);
+}
+
+int triangle_speed(int speed, int temp, int temp_change) {
+	return curve_step(&curve, speed, temp, temp_change);
+}
+
+int next_polling_interval(int interval_ms, int temp, int temp_rate) {
+	if (!adaptive_polling) {
+		return polling_interval_ms;
+	}
+
+	int floor_ms   = min(polling_interval_min_ms, polling_interval_ms);
+	int ceiling_ms = max(polling_interval_max_ms, polling_interval_ms);
+
+	// Heating up fast or already hot: react as soon as possible
+	if (temp >= high_temp * 1000 || temp_rate >= adaptive_rise_rate) {
+		return floor_ms;
+	}
+
+	// Cold and stable: back off, doubling up to the ceiling
+	if (temp < low_temp * 1000 && abs(temp_rate) <= adaptive_stable_rate) {
+		return min(max(interval_ms, floor_ms) * 2, ceiling_ms);
+	}
+
+	return polling_interval_ms;
+}
+
+void build_curve() {
+	t_curve_triangle triangle = settings_triangle();
+	curve_from(&curve, &curve_points, &triangle);
+}
+
+/* Format millidegrees as degrees with three decimals */
+static const char *format_millidegrees(char *buf, size_t n_buf, int temp) {
+	unsigned int magnitude = temp < 0 ? 0U - (unsigned int) temp : (unsigned int) temp;
+	snprintf(buf, n_buf, "%s%u.%03u", temp < 0 ? "-" : "", magnitude / 1000, magnitude % 1000);
+	return buf;
+}
+
+/* The parts of mbpfan() that reloads and the control socket act on */
+struct s_daemon {
+	t_loop      *loop;
+	t_scheduler *scheduler;
+	t_watch     *watch;
+	t_control   *control;
+
+	int profile_switched;  // the control socket loaded another settings file
+};
+
+typedef struct s_daemon t_daemon;
+
+/* io_uring and sensor_workers of the running sampling backend, -1 before it started */
+static int sampling_uring   = -1;
+static int sampling_workers = -1;
+
+/* Tear down the sampling backend, a batch in flight is read first */
+static void stop_sampling() {
+	if (pool_active()) {
+		pool_wait();
+	}
+
+	pool_exit();
+	uring_exit();
+
+	sampling_uring   = -1;
+	sampling_workers = -1;
+}
+
+/* Set up the sampling backend use_io_uring and sensor_workers ask for,
+ * replacing the running one when they changed
+ */
+static void start_sampling() {
+	int result;
+
+	if (sampling_uring == use_io_uring && sampling_workers == sensor_workers) {
+		return;
+	}
+
+	if (sampling_uring != -1) {
+		printf("Sampling settings changed, restarting the sampling of the sensors\n");
+	}
+
+	stop_sampling();
+
+	sampling_uring   = use_io_uring;
+	sampling_workers = sensor_workers;
+
+	if (use_io_uring) {
+		result = uring_init(sensors);
+
+		if (result == 0) {
+			printf("Sampling sensors through io_uring\n");
+		}
+		else {
+			printf("io_uring unavailable (%s), sampling sensors with pread\n", strerror(-result));
+		}
+	}
+
+	if (!uring_active() && sensor_workers > 0) {
+		result = pool_init(sensors, sensor_workers);
+
+		if (result == 0) {
+			printf("Sampling sensors with %d workers\n", min(sensor_workers, POOL_WORKERS_MAX));
+		}
+		else {
+			printf("Could not start sensor workers (%s), sampling sensors one by one\n", strerror(-result));
+		}
+	}
+}
+
+/* Start or stop following the settings file in use, as watch_config asks */
+static void follow_settings(t_daemon *daemon) {
+	t_watch *watch = daemon->watch;
+	int result;
+
+	// Another profile was loaded: follow that file instead
+	if (watch->fd != -1 && (!watch_config || strcmp(watch->path, profile) != 0)) {
+		loop_unwatch(daemon->loop, watch->fd);
+		watch_exit(watch);
+		printf("Stopped watching %s\n", watch->path);
+	}
+
+	if (watch_config && watch->fd == -1) {
+		result = watch_init(watch, profile);
+
+		if (result == 0) {
+			result = loop_watch(daemon->loop, watch->fd, watch_read, watch);
+		}
+
+		if (result == 0) {
+			printf("Watching %s for changes\n", profile);
+		}
+		else {
+			printf("Could not watch %s (%s), reload it with SIGHUP\n", profile, strerror(-result));
+			watch_exit(watch);
+		}
+	}
+}
+
+/* Hold the fans at speed for seconds, requested through the control socket */
+static int control_override(void *ctx, int speed, int seconds) {
+	(void) ctx;
+
+	if (seconds == 0) {
+		if (override_until != 0) {
+			printf("Fans released to the controller\n");
+		}
+
+		override_until = 0;
+		return 0;
+	}
+
+	override_speed = max(min(speed, max_fan_speed), min_fan_speed);
+	override_until = monotonic_ns() + seconds * 1000000000LL;
+
+	printf("Fans held at %d RPM for %d s\n", override_speed, seconds);
+	set_fan_speed(fans, override_speed);
+	return 0;
+}
+
+/* Load another settings file, requested through the control socket */
+static int control_profile(void *ctx, const char *path) {
+	t_daemon *daemon = ctx;
+
+	if (access(path, R_OK) != 0) {
+		return -errno;
+	}
+
+	int applied = retrieve_settings(path);
+	metrics_reload(applied);
+
+	if (!applied) {
+		return -EINVAL;
+	}
+
+	snprintf(profile, sizeof(profile), "%s", path);
+
+	// Watches cannot change from a handler: finish between two waits
+	daemon->profile_switched = 1;
+	loop_request(daemon->loop, LOOP_TIMER);
+	return 0;
+}
+
+/* Start or stop the control socket, as control_socket asks */
+static void serve_control(t_daemon *daemon) {
+	t_control *control = daemon->control;
+	int result;
+
+	if (control_socket && control->fd == -1) {
+		t_control_ops ops = { .override = control_override, .profile = control_profile, .ctx = daemon };
+
+		result = control_init(control, CONTROL_PATH, &ops);
+
+		if (result == 0) {
+			result = loop_watch(daemon->loop, control->fd, control_read, control);
+		}
+
+		if (result == 0) {
+			printf("Listening on %s\n", CONTROL_PATH);
+		}
+		else {
+			printf("Could not listen on %s (%s)\n", CONTROL_PATH, strerror(-result));
+			control_exit(control);
+		}
+	}
+	else if (!control_socket && control->fd != -1) {
+		loop_unwatch(daemon->loop, control->fd);
+		control_exit(control);
+		printf("Stopped listening on %s\n", CONTROL_PATH);
+	}
+}
+
+/* Start or stop publishing the ticks in shared memory, as shared_telemetry asks */
+static void share_telemetry() {
+	if (shared_telemetry && !telemetry_active()) {
+		int result = telemetry_init(TELEMETRY_PATH, sensors, fans);
+
+		if (result == 0) {
+			printf("Publishing every poll in %s\n", TELEMETRY_PATH);
+		}
+		else {
+			printf("Could not publish in %s (%s)\n", TELEMETRY_PATH, strerror(-result));
+		}
+	}
+	else if (!shared_telemetry && telemetry_active()) {
+		telemetry_exit();
+		printf("Stopped publishing in %s\n", TELEMETRY_PATH);
+	}
+}
+
+/* Start, move or stop the history, as history_file asks */
+static void keep_history() {
+	static char recording[PATH_MAX];
+	static int recording_max_size;
+	static int recording_files;
+
+	if (history_active() && strcmp(recording, history_file) == 0
+			&& recording_max_size == history_max_size && recording_files == history_files) {
+		return;
+	}
+
+	if (history_active()) {
+		history_exit();
+		printf("Stopped recording history in %s\n", recording);
+	}
+
+	recording[0] = '\0';
+
+	if (history_file[0] == '\0') {
+		return;
+	}
+
+	int result = history_init(history_file, history_max_size * 1024LL * 1024LL, history_files, sensors, fans);
+
+	if (result == 0) {
+		printf("Recording history in %s\n", history_file);
+		snprintf(recording, sizeof(recording), "%s", history_file);
+		recording_max_size = history_max_size;
+		recording_files    = history_files;
+	}
+	else {
+		printf("Could not record history in %s (%s)\n", history_file, strerror(-result));
+	}
+}
+
+/* Act on settings just loaded */
+static void apply_settings(t_daemon *daemon) {
+	follow_settings(daemon);
+	serve_control(daemon);
+	share_telemetry();
+	keep_history();
+	start_sampling();
+
+	if (!adaptive_polling && daemon->scheduler->interval_ms != polling_interval_ms) {
+		printf("Polling interval changed to %d ms\n", polling_interval_ms);
+		scheduler_set_interval(daemon->scheduler, polling_interval_ms);
+	}
+
+	fflush(stdout);
+}
+
+/* Wait for the next tick, starting the sensor workers ahead of it and
+ * reloading the settings when asked to or when their file changed
+ * Return FALSE when asked to shut down
+ */
+static int wait_for_tick(t_daemon *daemon) {
+	t_scheduler *scheduler = daemon->scheduler;
+	t_watch *watch = daemon->watch;
+	long long prefetch_at = 0;
+
+	if (pool_active() && sensor_prefetch_ms > 0 && sensor_prefetch_ms < scheduler->interval_ms) {
+		prefetch_at = scheduler->deadline - sensor_prefetch_ms * 1000000LL;
+	}
+
+	while (1) {
+		long long now = monotonic_ns();
+
+		// A reload may have stopped the workers meanwhile
+		if (prefetch_at != 0 && now >= prefetch_at) {
+			if (pool_active()) {
+				pool_start();
+			}
+
+			prefetch_at = 0;
+		}
+
+		if (daemon->profile_switched) {
+			daemon->profile_switched = 0;
+			apply_settings(daemon);
+		}
+
+		// Rewriting the file with the same content reloads nothing
+		if (watch->due_ns != 0 && now >= watch->due_ns && watch_changed(watch)) {
+			printf("%s changed, reloading it\n", profile);
+			metrics_reload(retrieve_settings(profile));
+			apply_settings(daemon);
+		}
+
+		if (now >= scheduler->deadline) {
+			return 1;
+		}
+
+		long long wake_at = prefetch_at != 0 ? prefetch_at : scheduler->deadline;
+
+		if (watch->due_ns != 0 && watch->due_ns < wake_at) {
+			wake_at = watch->due_ns;
+		}
+
+		loop_arm(daemon->loop, wake_at);
+
+		switch (loop_wait(daemon->loop)) {
+			case LOOP_EXIT:
+				return 0;
+
+			case LOOP_RELOAD:
+				// Remember what is loaded, so the events of the same change do not load it again
+				if (watch->fd != -1) {
+					watch_changed(watch);
+				}
+
+				metrics_reload(retrieve_settings(profile));
+				apply_settings(daemon);
+				break;
+
+			case LOOP_TIMER:
+				break;
+		}
+	}
+}
+
+void mbpfan() {
+	int old_temp  = 0;
+	int new_temp  = 0;
+	int fan_speed = 0;
+
+	int legacy_speed = 0;
+	int pid_speed    = 0;
+
+	int temp_change = 0;
+	int temp_rate   = 0;
+	int elapsed_ms  = 0;
+
+	char old_buf[16];
+	char new_buf[16];
+	char change_buf[16];
+	char rate_buf[16];
+
+	int metrics_result = 0;
+	int history_result = 0;
+
+	t_scheduler scheduler;
+	t_loop loop;
+	t_watch watch;
+	t_control control;
+	t_daemon daemon = { .loop = &loop, .scheduler = &scheduler, .watch = &watch, .control = &control };
+
+	watch.fd     = -1;
+	watch.due_ns = 0;
+
+	memset(&control, 0, sizeof(control));
+	control.fd      = -1;
+	control.profile = profile;
+
+	// Before any thread starts, so none of them gets the signals
+	int result = loop_init(&loop);
+
+	if (result != 0) {
+		printf("ERROR: Could not set up the event loop: %s\n", strerror(-result));
+		return;
+	}
+
+	retrieve_settings(profile);
+	follow_settings(&daemon);
+
+	printf("Retrieving sensors\n");
+	sensors = retrieve_sensors();
+	aggregation_bind(&aggregation, sensors);
+
+	printf("Aggregating temperatures with %s\n", aggregation_method_name(aggregation.method));
+
+	start_sampling();
+
+	printf("Retrieving fans\n");
+	fans = retrieve_fans();
+
+	set_fans_man(fans);
+
+	bind_zones(zones, zone_count);
+
+	estimator_reset(&estimator);
+	new_temp = get_predicted_temp(sensors, 0);
+
+	fan_speed    = min_fan_speed;
+	legacy_speed = min_fan_speed;
+	set_fan_speed(fans, fan_speed);
+
+	pid_reset(&pid);
+	if (control_mode == CONTROL_PID) {
+		printf("Controlling fans with pid\n");
+	}
+	else if (curve_points.count > 0) {
+		printf("Controlling fans with a %s curve of %u points\n", curve_points.interpolation == CURVE_CUBIC ? "cubic" : "linear", curve_points.count);
+	}
+	else {
+		printf("Controlling fans with triangle\n");
+	}
+
+	if (temp_estimator) {
+		printf("Controlling on temperatures predicted %d ms ahead (alpha %.3f, beta %.3f)\n", estimator.horizon_ms, estimator_alpha, estimator_beta);
+	}
+
+	printf("Polling interval set to %d ms\n", polling_interval_ms);
+
+	printf("Max temp  : %d\n", max_temp);
+	printf("High temp : %d\n", high_temp);
+	printf("Low temp  : %d\n", low_temp);
+
+	// The first tick gives the first temp delta
+	scheduler_init(&scheduler, polling_interval_ms);
+
+	// Once there are sensors and fans to answer about
+	serve_control(&daemon);
+	share_telemetry();
+	keep_history();
+
+	while (wait_for_tick(&daemon)) {
+		elapsed_ms = scheduler_tick(&scheduler);
+
+		long long tick_start = monotonic_ns();
+
+		old_temp    = new_temp;
+		new_temp    = get_predicted_temp(sensors, elapsed_ms);
+		temp_change = new_temp - old_temp;
+
+		// Per second over the time that really passed, not the nominal interval
+		temp_rate = (int)((long long) temp_change * 1000 / max(elapsed_ms, 1));
+
+		// Both controllers always run, so either can take over on a reload
+		legacy_speed = triangle_speed(legacy_speed, new_temp, temp_change);
+		pid_speed    = pid_update(&pid, new_temp, elapsed_ms);
+
+		fan_speed = control_mode == CONTROL_PID ? pid_speed : legacy_speed;
+
+		// The override never holds the fans down while the temperature peaks
+		if (override_until != 0 && (monotonic_ns() >= override_until || new_temp >= max_temp * 1000)) {
+			printf("Fan override ended\n");
+			override_until = 0;
+		}
+
+		if (override_until != 0) {
+			set_fan_speed(fans, override_speed);
+		}
+		else if (zone_count > 0) {
+			const int *samples = temp_estimator ? estimator.predicted : sensors->temperature;
+			int speeds[FANS_MAX];
+			unsigned int z;
+
+			for (z = 0; z < zone_count; z++) {
+				zone_update(&zones[z], samples);
+			}
+
+			// Max demand wins for fans in several zones
+			zones_arbitrate(zones, zone_count, fan_speed, speeds, fans->count);
+			set_fan_speeds(fans, speeds);
+
+			for (z = 0; z < zone_count; z++) {
+				if (zones[z].fan_count > 0) {
+					printf("Zone %s: %s, speed: %d\n", zones[z].name, format_millidegrees(change_buf, sizeof(change_buf), zones[z].temp), zones[z].speed);
+				}
+			}
+		}
+		else {
+			set_fan_speed(fans, fan_speed);
+		}
+
+		if (tach_feedback) {
+			check_fans(fans);
+		}
+
+		metrics_tick(&scheduler, monotonic_ns() - tick_start, new_temp, override_until != 0 ? override_speed : fan_speed);
+
+		if (metrics_textfile[0] != '\0') {
+			result = metrics_write(metrics_textfile, sensors, fans);
+
+			// Once per failure, not once per tick
+			if (result != metrics_result && result != 0) {
+				printf("Could not write %s: %s\n", metrics_textfile, strerror(-result));
+			}
+
+			metrics_result = result;
+		}
+
+		if (history_active()) {
+			result = history_record(sensors, fans);
+
+			if (result != history_result && result != 0) {
+				printf("Could not record history in %s: %s\n", history_file, strerror(-result));
+			}
+
+			history_result = result;
+		}
+
+		if (temp_estimator) {
+			printf("Measured: %s, predicted %d ms ahead: %s\n",
+				format_millidegrees(change_buf, sizeof(change_buf), aggregate_temp(&aggregation, sensors->temperature, sensors->count)),
+				estimator.horizon_ms, format_millidegrees(new_buf, sizeof(new_buf), new_temp));
+		}
+
+		printf("Old: %s, new: %s, change: %s (%s/s over %d ms), speed: %d (triangle: %d, pid: %d), sampled in %ld us with %u syscalls, fan writes: %lu issued, %lu suppressed, late: %d ms, missed: %lu\n",
+			format_millidegrees(old_buf, sizeof(old_buf), old_temp),
+			format_millidegrees(new_buf, sizeof(new_buf), new_temp),
+			format_millidegrees(change_buf, sizeof(change_buf), temp_change),
+			format_millidegrees(rate_buf, sizeof(rate_buf), temp_rate), elapsed_ms,
+			fan_speed, legacy_speed, pid_speed, sensors->sample_ns / 1000, sensors->sample_syscalls,
+			fans->writes_issued, fans->writes_suppressed, scheduler.late_ms, scheduler.missed);
+
+		int interval_ms = next_polling_interval(scheduler.interval_ms, new_temp, temp_rate);
+
+		if (interval_ms != scheduler.interval_ms) {
+			printf("Polling interval changed to %d ms\n", interval_ms);
+			scheduler_set_interval(&scheduler, interval_ms);
+		}
+
+		control.state.temp           = new_temp;
+		control.state.speed          = fan_speed;
+		control.state.override_speed = override_until != 0 ? override_speed : 0;
+		control.state.override_left  = override_until != 0 ? (int)((override_until - monotonic_ns()) / 1000000000LL) : 0;
+		control.state.interval_ms    = scheduler.interval_ms;
+		control.state.late_ms        = scheduler.late_ms;
+		control.state.ticks          = scheduler.ticks;
+		control.state.missed         = scheduler.missed;
+
+		if (telemetry_active()) {
+			int measured_temp = temp_estimator ? aggregate_temp(&aggregation, sensors->temperature, sensors->count) : new_temp;
+			telemetry_publish(sensors, fans, &scheduler, elapsed_ms, measured_temp, new_temp, override_until != 0 ? override_speed : fan_speed);
+		}
+
+		fflush(stdout);
+	}
+
+	printf("Shutting down\n");
+
+	set_fans_auto(fans);
+	free_fans(fans);
+	fans = NULL;
+
+	stop_sampling();
+	free_sensors(sensors);
+	sensors = NULL;
+
+	history_exit();
+	telemetry_exit();
+	control_exit(&control);
+	watch_exit(&watch);
+	loop_exit(&loop);
+}
+
+/* The fans and sensors of the machine as a plant to autotune */
+static void autotune_set_speed(void *ctx, int speed) {
+	(void) ctx;
+	set_fan_speed(fans, speed);
+}
+
+static int autotune_read_temp(void *ctx) {
+	(void) ctx;
+	return get_temp(sensors);
+}
+
+static void autotune_wait(void *ctx, int ms) {
+	struct timespec delay = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+	(void) ctx;
+
+	while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {
+	}
+}
+
+int mbpfan_autotune(const char *settings_path) {
+	t_autotune at;
+	t_autotune_model model;
+	double kp, ki, kd;
+	int result;
+
+	t_autotune_plant plant = {
+		.set_speed = autotune_set_speed,
+		.read_temp = autotune_read_temp,
+		.wait      = autotune_wait,
+		.ctx       = NULL,
+	};
+
+	if (settings_path == NULL) {
+		settings_path = SETTINGS_PATH;
+	}
+
+	retrieve_settings(settings_path);
+
+	sensors = retrieve_sensors();
+	aggregation_bind(&aggregation, sensors);
+	fans = retrieve_fans();
+
+	if (sensors->count == 0 || fans->count == 0) {
+		printf("Autotuning needs at least one sensor and one fan\n");
+		result = -ENODEV;
+	}
+	else {
+		set_fans_man(fans);
+
+		// Past max_temp the machine would be hotter than mbpfan allows
+		autotune_init(&at, min_fan_speed, max_fan_speed, max_temp * 1000);
+		result = autotune_run(&at, &plant, &model);
+
+		set_fans_auto(fans);
+	}
+
+	free_fans(fans);
+	free_sensors(sensors);
+	fans    = NULL;
+	sensors = NULL;
+
+	if (result != 0) {
+		printf("Autotuning failed: %s\n", result == -ERANGE ? "the temperature reached max_temp or barely moved" : strerror(-result));
+		return result;
+	}
+
+	autotune_pid(&model, &kp, &ki, &kd);
+
+	printf("Model: %.6f degrees per RPM, time constant %.1f s, dead time %.1f s\n", model.gain, model.tau, model.dead_time);
+	printf("PID gains: pid_kp = %.1f, pid_ki = %.3f, pid_kd = %.1f\n", kp, ki, kd);
+
+	result = autotune_save(settings_path, &model, kp, ki, kd);
+
+	if (result != 0) {
+		printf("Could not write %s: %s\n", settings_path, strerror(-result));
+		return result;
+	}
+
+	printf("Wrote the gains to %s, with control_mode = pid, the previous file is kept as %s.bak\n", settings_path, settings_path);
+	return 0;
 }
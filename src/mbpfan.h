@@ -18,10 +18,80 @@
 #define _MBPFAN_H_
 
 /** Basic fan speed parameters
-*/
+ *  Fans that report fanN_min and fanN_max get this range
+ *  mapped onto their own
+ */
 extern int min_fan_speed;
 extern int max_fan_speed;
 
+/** Reload the settings by themselves when their file changes,
+ *  instead of only on SIGHUP
+ */
+extern int watch_config;
+
+/** Answer state queries and take overrides on CONTROL_PATH, see control.h
+ */
+extern int control_socket;
+
+/** Publish every tick in TELEMETRY_PATH, see telemetry.h
+ */
+extern int shared_telemetry;
+
+/** Node exporter textfile the metrics are written to every tick,
+ *  empty for none, see metrics.h
+ */
+extern char metrics_textfile[];
+
+/** History of every tick, see history.h
+ *  history_file     - file recorded into, empty for none
+ *  history_max_size - megabytes a file grows to before it is rotated
+ *  history_files    - rotated files kept
+ */
+extern char history_file[];
+extern int history_max_size;
+extern int history_files;
+
+/** Speed changes of at most this many RPM are not written
+ *  0 only skips writes of an unchanged speed
+ */
+extern int fan_speed_deadband;
+
+/** Control law driving the fans
+ *  CONTROL_TRIANGLE - triangular steps between low_temp, high_temp and max_temp
+ *  CONTROL_PID      - PID controller holding pid_setpoint
+ */
+enum control_mode {
+	CONTROL_TRIANGLE,
+	CONTROL_PID,
+};
+
+extern int control_mode;
+
+/** PID tuning
+ *  pid_setpoint - temperature to hold in degrees, 0 for high_temp
+ *  pid_kp       - RPM per degree above the setpoint
+ *  pid_ki       - RPM per degree-second above the setpoint
+ *  pid_kd       - RPM per degree per second of temperature rise
+ *  pid_filter   - derivative low-pass time constant in seconds
+ */
+extern double pid_setpoint;
+extern double pid_kp;
+extern double pid_ki;
+extern double pid_kd;
+extern double pid_filter;
+
+struct s_pid;
+extern struct s_pid pid;
+
+/** Tachometer feedback
+ *  tach_feedback  - read fanN_input back on every poll
+ *  tach_tolerance - RPM a fan may be off its set speed
+ *  tach_checks    - polls a fan may stay off before it is reported
+ */
+extern int tach_feedback;
+extern int tach_tolerance;
+extern int tach_checks;
+
 /** Temperature Thresholds
  *  low_temp - temperature below which fan speed will be at minimum
  *  high_temp - fan will increase speed when higher than this temperature
@@ -30,10 +100,57 @@ extern int low_temp;
 extern int high_temp;
 extern int max_temp;
 
-/** Temperature polling interval
+/** Temperature polling interval in milliseconds
+ *  Configured in seconds, with decimals
  *  Default value was 10 (seconds)
  */
-extern int polling_interval;
+extern int polling_interval_ms;
+
+/** Adaptive polling
+ *  adaptive_polling        - adapt the interval to the thermal state
+ *  polling_interval_min_ms - interval while hot or heating up fast
+ *  polling_interval_max_ms - longest interval while cold and stable
+ *  adaptive_rise_rate      - millidegrees per second counting as heating up fast
+ *  adaptive_stable_rate    - millidegrees per second counting as stable
+ */
+extern int adaptive_polling;
+extern int polling_interval_min_ms;
+extern int polling_interval_max_ms;
+extern int adaptive_rise_rate;
+extern int adaptive_stable_rate;
+
+/** Sample sensors through io_uring when available
+ */
+extern int use_io_uring;
+
+/** Number of threads reading sensors concurrently, 0 to disable
+ *  and how long before a poll they start reading, in milliseconds
+ */
+extern int sensor_workers;
+extern int sensor_prefetch_ms;
+
+/** Reads one sensor, sysfs_read_int() unless replaced by the tests
+ */
+extern int (*sensor_read)(int fd, int *out);
+
+/** How get_temp() reduces the sensors to one temperature
+ */
+struct s_aggregation;
+extern struct s_aggregation aggregation;
+
+/** Temperature estimation
+ *  temp_estimator     - control on estimated rather than raw temperatures
+ *  estimator_alpha    - share of each sample's surprise taken into the temperature, 0 to 1
+ *  estimator_beta     - share taken into the rate of change, 0 to 1
+ *  prediction_horizon - seconds ahead the controllers look
+ */
+extern int temp_estimator;
+extern double estimator_alpha;
+extern double estimator_beta;
+extern double prediction_horizon;
+
+struct s_estimator;
+extern struct s_estimator estimator;
 
 /** Represents a Temperature sensor
 */
@@ -48,53 +165,156 @@ typedef struct s_fans t_fans;
  * Tries to use the settings located in
  * /etc/mbpfan.conf
  * If it fails, the default hardcoded settings are used
+ * The file is read and checked as a whole before any setting changes:
+ * invalid settings are rejected and the running ones kept
+ * Return TRUE if the settings were applied
  */
-void retrieve_settings(const char* settings_path);
+int retrieve_settings(const char* settings_path);
+
+/**
+ * Read history_file from the settings file at settings_path, or from
+ * /etc/mbpfan.conf if NULL, without applying anything
+ * Return TRUE if the file names one
+ */
+int retrieve_history_file(const char *settings_path, char *out_buf, unsigned int n_out_buf);
 
 /**
  * Detect the sensors in /sys/devices/platform/applesmc.768/
- * Return a linked list of t_sensors (first temperature detected)
+ * with a single scan of the directory, matching every tempN_input
+ * Return a table of t_sensors, ordered by N
  */
 t_sensors *retrieve_sensors();
 
 /**
- * Given a linked list of t_sensors, refresh their detected
+ * Given a table of t_sensors, refresh their detected
  * temperature
  */
 t_sensors *refresh_sensors(t_sensors *sensors);
 
+/**
+ * Account for a failed read of sensor i, error is a negative errno
+ * The previous sample of the sensor is kept
+ */
+void sensor_read_failed(t_sensors *sensors, unsigned int i, int error);
+
 /**
  * Detect the fans in /sys/devices/platform/applesmc.768/
- * Associate each fan to a sensor
+ * Return a table of t_fans
  */
 t_fans* retrieve_fans();
 
 /**
- * Given a list of sensors with associated fans
+ * Close the files held by a table and free it
+ */
+void free_sensors(t_sensors *sensors);
+void free_fans(t_fans *fans);
+
+/**
+ * Given a table of fans
  * Set them to manual control
  */
 void set_fans_man(t_fans *fans);
 
 /**
- * Given a list of sensors with associated fans
+ * Given a table of fans
  * Set them to automatic control
  */
 void set_fans_auto(t_fans *fans);
 
 /**
- * Given a list of sensors with associated fans
- * Change their speed
+ * Map a speed between min_fan_speed and max_fan_speed onto
+ * the fanN_min to fanN_max range of fan i, when it has one
+ */
+int fan_target_speed(const t_fans *fans, unsigned int i, int speed);
+
+/**
+ * Given a table of fans
+ * Change their speed, skipping writes that would not change
+ * it by more than fan_speed_deadband
  */
 void set_fan_speed(t_fans* fans, int speed);
 
 /**
- *  Return average CPU temp in degrees (ceiling)
+ * Given a table of fans
+ * Change the speed of each one to its own entry of speeds
+ */
+void set_fan_speeds(t_fans *fans, const int *speeds);
+
+/**
+ * Compare the measured speed of each fan with the speed last
+ * written, report stalled and lagging fans and put fans the SMC
+ * took back under automatic control into manual mode again
+ */
+void check_fans(t_fans *fans);
+
+/**
+ *  Return the aggregated CPU temp in millidegrees
+ */
+int get_temp(t_sensors* sensors);
+
+/**
+ *  Return the aggregated CPU temp in millidegrees as predicted
+ *  prediction_horizon ahead, from samples taken dt_ms after the
+ *  previous ones; the same as get_temp() without temp_estimator
+ */
+int get_predicted_temp(t_sensors* sensors, int dt_ms);
+
+/**
+ * Fan speed on the rising and on the falling branch of the
+ * fan curve, for a temperature in millidegrees, computed
+ * analytically: the control loop uses the table in curve
+ */
+int curve_speed_up(int temp);
+int curve_speed_down(int temp);
+
+/** The fan curve followed by triangle_speed(), as a lookup table
+ */
+struct s_curve;
+extern struct s_curve curve;
+
+/** Points of the [curve] section, replacing the triangle when set
+ */
+struct s_curve_points;
+extern struct s_curve_points curve_points;
+
+/** Number of zones configured, see zone.h
+ *  Fans in no zone follow the main controller
+ */
+extern unsigned int zone_count;
+
+/**
+ * Materialize curve_points, or curve_speed_up() and curve_speed_down()
+ * when there are none, into curve
+ * retrieve_settings() builds it along with the settings it loads
  */
-unsigned short get_temp(t_sensors* sensors);
+void build_curve();
+
+/**
+ * One step of the curve control law: the fan speed following speed
+ * for a temperature and its change, in millidegrees
+ */
+int triangle_speed(int speed, int temp, int temp_change);
+
+/**
+ * Polling interval to use after a tick that measured temp and
+ * temp_rate, in millidegrees and millidegrees per second
+ */
+int next_polling_interval(int interval_ms, int temp, int temp_rate);
 
 /**
  * Main Program
+ * Controls the fans until SIGTERM, SIGINT or SIGQUIT, reloading the
+ * settings on SIGHUP, then gives the fans back to the SMC
  */
 void mbpfan();
 
+/**
+ * Step the fans, fit a thermal model to the response and write
+ * PID gains derived from it into the settings file at settings_path,
+ * /etc/mbpfan.conf when NULL
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int mbpfan_autotune(const char *settings_path);
+
 #endif
@@ -0,0 +1,252 @@
+/* metrics.c - counters and gauges for Prometheus
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Most counters already live in the sensor and fan tables and the
+ * scheduler; this adds the tick duration histogram and the reloads,
+ * and renders all of them into static buffers with integer formatting
+ * only, so that exporting every tick never allocates.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "global.h"
+#include "scheduler.h"
+#include "metrics.h"
+
+static const long long bucket_us[METRICS_BUCKETS] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000 };
+
+static struct {
+	unsigned long ticks;
+	unsigned long missed;
+	int           late_ms;
+	int           temp;
+	int           speed;
+
+	unsigned long duration_buckets[METRICS_BUCKETS];  // cumulative, as exposed
+	unsigned long duration_count;
+	long long     duration_sum_ns;
+
+	unsigned long reloads_applied;
+	unsigned long reloads_rejected;
+} metrics;
+
+static char buffer[METRICS_BUFFER_MAX];
+static size_t length;
+
+static char tmp_path[PATH_MAX];
+
+void metrics_tick(const t_scheduler *scheduler, long long duration_ns, int temp, int speed) {
+	unsigned int i;
+
+	metrics.ticks   = scheduler->ticks;
+	metrics.missed  = scheduler->missed;
+	metrics.late_ms = scheduler->late_ms;
+	metrics.temp    = temp;
+	metrics.speed   = speed;
+
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		if (duration_ns <= bucket_us[i] * 1000) {
+			metrics.duration_buckets[i]++;
+		}
+	}
+
+	metrics.duration_count++;
+	metrics.duration_sum_ns += duration_ns;
+}
+
+void metrics_reload(int applied) {
+	if (applied) {
+		metrics.reloads_applied++;
+	}
+	else {
+		metrics.reloads_rejected++;
+	}
+}
+
+/* Append to the buffer, silently truncated at its end */
+static void append(const char *format, ...) {
+	va_list args;
+
+	if (length >= sizeof(buffer) - 1) {
+		return;
+	}
+
+	va_start(args, format);
+	int n = vsnprintf(buffer + length, sizeof(buffer) - length, format, args);
+	va_end(args);
+
+	if (n > 0) {
+		length = length + (size_t) n < sizeof(buffer) ? length + (size_t) n : sizeof(buffer) - 1;
+	}
+}
+
+static void append_header(const char *name, const char *type, const char *help) {
+	append("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Thousandths, such as millidegrees or milliseconds, without floating point */
+static void append_milli(int value) {
+	unsigned int magnitude = value < 0 ? 0U - (unsigned int) value : (unsigned int) value;
+	append(" %s%u.%03u\n", value < 0 ? "-" : "", magnitude / 1000, magnitude % 1000);
+}
+
+/* A label value, escaped, or the sysfs name when there is none */
+static void append_label(const char *key, const char *label, const char *prefix, unsigned int index) {
+	const char *c;
+
+	if (label[0] == '\0') {
+		append("{%s=\"%s%u\",index=\"%u\"}", key, prefix, index, index);
+		return;
+	}
+
+	append("{%s=\"", key);
+
+	for (c = label; *c != '\0' && c < label + LABEL_LEN; c++) {
+		if (*c == '"' || *c == '\\') {
+			append("\\%c", *c);
+		}
+		else if (*c == '\n') {
+			append("\\n");
+		}
+		else {
+			append("%c", *c);
+		}
+	}
+
+	append("\",index=\"%u\"}", index);
+}
+
+const char *metrics_render(const t_sensors *sensors, const t_fans *fans, size_t *rendered) {
+	unsigned int i;
+
+	length = 0;
+
+	append_header("mbpfan_ticks_total", "counter", "Polls of the sensors.");
+	append("mbpfan_ticks_total %lu\n", metrics.ticks);
+
+	append_header("mbpfan_missed_ticks_total", "counter", "Polling deadlines skipped because a poll overran.");
+	append("mbpfan_missed_ticks_total %lu\n", metrics.missed);
+
+	append_header("mbpfan_tick_late_seconds", "gauge", "How late the last poll started.");
+	append("mbpfan_tick_late_seconds");
+	append_milli(metrics.late_ms);
+
+	append_header("mbpfan_tick_duration_seconds", "histogram", "Time from reading the sensors to writing the fans.");
+
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		append("mbpfan_tick_duration_seconds_bucket{le=\"%lld.%06lld\"} %lu\n", bucket_us[i] / 1000000, bucket_us[i] % 1000000, metrics.duration_buckets[i]);
+	}
+
+	append("mbpfan_tick_duration_seconds_bucket{le=\"+Inf\"} %lu\n", metrics.duration_count);
+	append("mbpfan_tick_duration_seconds_sum %lld.%09lld\n", metrics.duration_sum_ns / 1000000000LL, metrics.duration_sum_ns % 1000000000LL);
+	append("mbpfan_tick_duration_seconds_count %lu\n", metrics.duration_count);
+
+	append_header("mbpfan_temperature_celsius", "gauge", "Temperature the fans were last set for.");
+	append("mbpfan_temperature_celsius");
+	append_milli(metrics.temp);
+
+	append_header("mbpfan_speed_rpm", "gauge", "Fan speed last chosen by the controller.");
+	append("mbpfan_speed_rpm %d\n", metrics.speed);
+
+	append_header("mbpfan_reloads_total", "counter", "Reloads of the settings.");
+	append("mbpfan_reloads_total{result=\"applied\"} %lu\n", metrics.reloads_applied);
+	append("mbpfan_reloads_total{result=\"rejected\"} %lu\n", metrics.reloads_rejected);
+
+	if (sensors != NULL) {
+		append_header("mbpfan_sensor_temperature_celsius", "gauge", "Last sample of each sensor.");
+
+		for (i = 0; i < sensors->count; i++) {
+			append("mbpfan_sensor_temperature_celsius");
+			append_label("sensor", sensors->label[i], "temp", sensors->index[i]);
+			append_milli(sensors->temperature[i]);
+		}
+
+		append_header("mbpfan_sensor_read_errors_total", "counter", "Failed reads of each sensor.");
+
+		for (i = 0; i < sensors->count; i++) {
+			append("mbpfan_sensor_read_errors_total");
+			append_label("sensor", sensors->label[i], "temp", sensors->index[i]);
+			append(" %u\n", sensors->read_errors[i]);
+		}
+	}
+
+	if (fans != NULL) {
+		append_header("mbpfan_fan_speed_rpm", "gauge", "Speed last written to each fan.");
+
+		for (i = 0; i < fans->count; i++) {
+			append("mbpfan_fan_speed_rpm");
+			append_label("fan", fans->label[i], "fan", fans->index[i]);
+			append(" %d\n", fans->last_written[i]);
+		}
+
+		append_header("mbpfan_fan_measured_rpm", "gauge", "Speed last read back from each fan, with tach_feedback.");
+
+		for (i = 0; i < fans->count; i++) {
+			append("mbpfan_fan_measured_rpm");
+			append_label("fan", fans->label[i], "fan", fans->index[i]);
+			append(" %d\n", fans->measured[i]);
+		}
+
+		append_header("mbpfan_fan_writes_total", "counter", "Fan speed writes, issued or suppressed as redundant.");
+		append("mbpfan_fan_writes_total{result=\"issued\"} %lu\n", fans->writes_issued);
+		append("mbpfan_fan_writes_total{result=\"suppressed\"} %lu\n", fans->writes_suppressed);
+	}
+
+	*rendered = length;
+	return buffer;
+}
+
+int metrics_write(const char *path, const t_sensors *sensors, const t_fans *fans) {
+	size_t rendered;
+	const char *text = metrics_render(sensors, fans, &rendered);
+	ssize_t written = 0;
+	size_t done = 0;
+	int result = 0;
+
+	if ((size_t) snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path)) {
+		return -ENAMETOOLONG;
+	}
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd == -1) {
+		return -errno;
+	}
+
+	while (done < rendered) {
+		written = write(fd, text + done, rendered - done);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			result = -errno;
+			break;
+		}
+
+		done += (size_t) written;
+	}
+
+	if (close(fd) != 0 && result == 0) {
+		result = -errno;
+	}
+
+	// The exporter reads the whole old file or the whole new one
+	if (result == 0 && rename(tmp_path, path) != 0) {
+		result = -errno;
+	}
+
+	if (result != 0) {
+		unlink(tmp_path);
+	}
+
+	return result;
+}
@@ -0,0 +1,64 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stddef.h>
+
+/** Room for the rendered metrics, enough for full sensor and fan tables
+ */
+#define METRICS_BUFFER_MAX 32768
+
+/** Upper bounds of the tick duration histogram, in microseconds
+ */
+#define METRICS_BUCKETS 11
+
+struct s_sensors;
+typedef struct s_sensors t_sensors;
+
+struct s_fans;
+typedef struct s_fans t_fans;
+
+struct s_scheduler;
+typedef struct s_scheduler t_scheduler;
+
+/**
+ * Account for a tick that took duration_ns from reading the sensors
+ * to writing the fans, and left the fans at speed for temp
+ */
+void metrics_tick(const t_scheduler *scheduler, long long duration_ns, int temp, int speed);
+
+/**
+ * Account for a reload, applied or rejected
+ */
+void metrics_reload(int applied);
+
+/**
+ * Render the metrics in the Prometheus text exposition format into a
+ * buffer allocated once, valid until the next call
+ * Return the rendered text
+ */
+const char *metrics_render(const t_sensors *sensors, const t_fans *fans, size_t *length);
+
+/**
+ * Render the metrics into a textfile for the node exporter at path,
+ * replaced atomically so that it is never read half written
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int metrics_write(const char *path, const t_sensors *sensors, const t_fans *fans);
+
+#endif
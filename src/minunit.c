@@ -1,35 +1,58 @@
 /* file minunit_example.c */
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
 #include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/utsname.h>
 #include "global.h"
 #include "mbpfan.h"
 #include "settings.h"
+#include "sysfs.h"
+#include "uring.h"
+#include "pool.h"
+#include "aggregate.h"
+#include "pid.h"
+#include "scheduler.h"
+#include "curve.h"
+#include "estimator.h"
+#include "zone.h"
+#include "autotune.h"
+#include "loop.h"
+#include "watch.h"
+#include "control.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "history.h"
 #include "minunit.h"
 
 int tests_run = 0;
 
 static const char *test_sensor_paths() {
 	t_sensors* sensors = retrieve_sensors();
-	mu_assert("No sensors found", sensors != NULL);
-	t_sensors* tmp = sensors;
+	mu_assert("No sensors found", sensors != NULL && sensors->count > 0);
+	unsigned int i;
 
-	while(tmp != NULL) {
-		mu_assert("Sensor does not have a valid path", tmp->path != NULL);
-		mu_assert("Sensor does not have a valid path_sensor_input", tmp->path_sensor_input != NULL);
-		mu_assert("Sensor does not have a valid path_sensor_label", tmp->path_sensor_label != NULL);
+	for (i = 0; i < sensors->count; i++) {
+		mu_assert("Sensor does not have a valid input file", sensors->fd[i] >= 0);
+		mu_assert("Sensor does not have valid temperature", sensors->temperature[i] > 0);
 
-		if (tmp->path != NULL) {
-			mu_assert("Sensor does not have valid temperature", tmp->temperature > 0);
+		if (i > 0) {
+			mu_assert("Sensors are not ordered by index", sensors->index[i - 1] < sensors->index[i]);
 		}
-
-		tmp = tmp->next;
 	}
 
+	free_sensors(sensors);
 	return 0;
 }
 
@@ -38,18 +61,17 @@ static const char *test_fan_paths() {
 	t_fans* fans = retrieve_fans();
 	mu_assert("No fans found", fans != NULL);
 
-	t_fans* tmp = fans;
+	unsigned int i;
 	int found_fan_path = 0;
 
-	while(tmp != NULL) {
-		if (tmp->path_fan_output != NULL) {
+	for (i = 0; i < fans->count; i++) {
+		if (fans->fd_output[i] >= 0) {
 			found_fan_path++;
 		}
-
-		tmp = tmp->next;
 	}
 
 	mu_assert("No fans found", found_fan_path != 0);
+	free_fans(fans);
 	return 0;
 }
 
@@ -86,10 +108,10 @@ int stress(int n) {
 static const char *test_get_temp() {
 	t_sensors* sensors = retrieve_sensors();
 	mu_assert("No sensors found", sensors != NULL);
-	unsigned short temp_1 = get_temp(sensors);
-	mu_assert("Invalid Global Temperature Found", temp_1 > 1 && temp_1 < 150);
+	int temp_1 = get_temp(sensors);
+	mu_assert("Invalid Global Temperature Found", temp_1 > 1000 && temp_1 < 150000);
 	stress(2000);
-	unsigned short temp_2 = get_temp(sensors);
+	int temp_2 = get_temp(sensors);
 	mu_assert("Invalid Higher temp test (if fan was already spinning high, this is not worrying)", temp_1 < temp_2);
 	return 0;
 }
@@ -127,10 +149,951 @@ static const char *test_config_file() {
 static const char *test_settings() {
 	retrieve_settings("./mbpfan.conf.test1");
 	mu_assert("max_fan_speed value is not 5600", max_fan_speed == 5600);
-	mu_assert("polling_interval is not 1", polling_interval == 1);
+	mu_assert("polling_interval is not 1", polling_interval_ms == 1000);
 	retrieve_settings("./mbpfan.conf");
 	mu_assert("min_fan_speed value is not 0", min_fan_speed == 0);
-	mu_assert("polling_interval is not 3", polling_interval == 3);
+	mu_assert("polling_interval is not 3", polling_interval_ms == 3000);
+	return 0;
+}
+
+static const char *test_sysfs_parse() {
+	int value = 0;
+
+	mu_assert("Could not parse a plain temperature", sysfs_parse_int("45250\n", 6, &value) == 0 && value == 45250);
+	mu_assert("Could not parse a value without newline", sysfs_parse_int("6000", 4, &value) == 0 && value == 6000);
+	mu_assert("Could not parse a negative value", sysfs_parse_int("-5\n", 3, &value) == 0 && value == -5);
+	mu_assert("Could not parse INT_MIN", sysfs_parse_int("-2147483648", 11, &value) == 0 && value == INT_MIN);
+	mu_assert("Could not parse INT_MAX", sysfs_parse_int("2147483647\n", 11, &value) == 0 && value == INT_MAX);
+
+	value = 42;
+	mu_assert("Empty attribute was accepted", sysfs_parse_int("\n", 1, &value) == -EINVAL);
+	mu_assert("Lone sign was accepted", sysfs_parse_int("-", 1, &value) == -EINVAL);
+	mu_assert("Garbage was accepted", sysfs_parse_int("45a50\n", 6, &value) == -EINVAL);
+	mu_assert("Overflow was accepted", sysfs_parse_int("2147483648", 10, &value) == -ERANGE);
+	mu_assert("Failed parse changed the value", value == 42);
+
+	mu_assert("Read from a bad fd did not fail", sysfs_read_int(-1, &value) == -EBADF);
+	return 0;
+}
+
+static long elapsed_ns(const struct timespec *start, const struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+static const char *test_sysfs_parse_benchmark() {
+	const char *samples[] = { "45250\n", "38000\n", "102375\n", "0\n" };
+	const int iterations = 1000000;
+
+	struct timespec start;
+	struct timespec end;
+	int i;
+
+	volatile int sink = 0;
+	int value = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < iterations; i++) {
+		sscanf(samples[i & 3], "%d", &value);
+		sink += value;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long sscanf_ns = elapsed_ns(&start, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < iterations; i++) {
+		const char *sample = samples[i & 3];
+		sysfs_parse_int(sample, strlen(sample), &value);
+		sink += value;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long parse_ns = elapsed_ns(&start, &end);
+
+	printf("sscanf: %ld ns/read, sysfs_parse_int: %ld ns/read\n", sscanf_ns / iterations, parse_ns / iterations);
+	mu_assert("sysfs_parse_int is slower than sscanf", parse_ns < sscanf_ns);
+	return 0;
+}
+
+static const char *test_uring_refresh() {
+	t_sensors* sensors = retrieve_sensors();
+	mu_assert("No sensors found", sensors != NULL);
+
+	int result = uring_init(sensors);
+
+	if (result != 0) {
+		printf("io_uring unavailable (%s), skipping\n", strerror(-result));
+		free_sensors(sensors);
+		return 0;
+	}
+
+	unsigned int i;
+
+	for (i = 0; i < sensors->count; i++) {
+		sensors->temperature[i] = 0;
+	}
+
+	refresh_sensors(sensors);
+	mu_assert("io_uring refresh took more than one system call", sensors->sample_syscalls == 1);
+
+	for (i = 0; i < sensors->count; i++) {
+		mu_assert("io_uring refresh did not read a valid temperature", sensors->temperature[i] > 0);
+	}
+
+	uring_exit();
+	free_sensors(sensors);
+	return 0;
+}
+
+static char fake_applesmc[] = "/tmp/mbpfan-test-XXXXXX";
+static const char *real_applesmc = NULL;
+
+static void write_fake_attribute(const char *name, int value) {
+	char path[sizeof(fake_applesmc) + 32];
+	snprintf(path, sizeof(path), "%s/%s", fake_applesmc, name);
+
+	FILE *file = fopen(path, "w");
+
+	if (file != NULL) {
+		fprintf(file, "%d\n", value);
+		fclose(file);
+	}
+}
+
+/* Build a fake applesmc directory and point APPLESMC_PATH at it */
+static int make_fake_applesmc(unsigned int sensors_count, unsigned int fans_count) {
+	char name[32];
+	unsigned int i;
+
+	strcpy(fake_applesmc + sizeof(fake_applesmc) - 7, "XXXXXX");
+
+	if (mkdtemp(fake_applesmc) == NULL) {
+		return 0;
+	}
+
+	for (i = 1; i <= sensors_count; i++) {
+		snprintf(name, sizeof(name), "temp%u_input", i);
+		write_fake_attribute(name, 40000 + (int) i * 250);
+	}
+
+	for (i = 1; i <= fans_count; i++) {
+		snprintf(name, sizeof(name), "fan%u_output", i);
+		write_fake_attribute(name, 2000);
+		snprintf(name, sizeof(name), "fan%u_manual", i);
+		write_fake_attribute(name, 0);
+	}
+
+	real_applesmc = APPLESMC_PATH;
+	APPLESMC_PATH = fake_applesmc;
+	return 1;
+}
+
+static void remove_fake_applesmc() {
+	char path[sizeof(fake_applesmc) + 256];
+	struct dirent *entry;
+	DIR *dir = opendir(fake_applesmc);
+
+	while (dir != NULL && (entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", fake_applesmc, entry->d_name);
+			unlink(path);
+		}
+	}
+
+	if (dir != NULL) {
+		closedir(dir);
+	}
+
+	rmdir(fake_applesmc);
+	APPLESMC_PATH = real_applesmc;
+}
+
+static const char *test_fan_discovery() {
+	unsigned int i;
+
+	// Past the six slots applesmc used to be probed for
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(1, FANS_MAX));
+	t_fans *fans = retrieve_fans();
+	mu_assert("Fans were missed", fans->count == FANS_MAX);
+
+	for (i = 0; i < fans->count; i++) {
+		mu_assert("Fans are out of order", fans->index[i] == i + 1);
+	}
+
+	free_fans(fans);
+	remove_fake_applesmc();
+	return 0;
+}
+
+/* Every read pays a simulated SMC transaction */
+static int slow_sensor_read(int fd, int *out) {
+	struct timespec latency = { .tv_sec = 0, .tv_nsec = 2000000L };
+	nanosleep(&latency, NULL);
+	return sysfs_read_int(fd, out);
+}
+
+static const char *test_pool_benchmark() {
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(16, 0));
+
+	t_sensors* sensors = retrieve_sensors();
+	sensor_read = slow_sensor_read;
+
+	struct timespec start;
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	refresh_sensors(sensors);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long serial_ns = elapsed_ns(&start, &end);
+
+	unsigned int i;
+
+	for (i = 0; i < sensors->count; i++) {
+		sensors->temperature[i] = 0;
+	}
+
+	pool_init(sensors, 4);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	refresh_sensors(sensors);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long pool_ns = elapsed_ns(&start, &end);
+
+	pool_exit();
+	sensor_read = sysfs_read_int;
+
+	printf("16 sensors at 2 ms each: %ld us one by one, %ld us with 4 workers\n", serial_ns / 1000, pool_ns / 1000);
+
+	for (i = 0; i < sensors->count; i++) {
+		mu_assert("Workers did not read every sensor", sensors->temperature[i] == 40000 + (int) sensors->index[i] * 250);
+	}
+
+	free_sensors(sensors);
+	remove_fake_applesmc();
+
+	mu_assert("Workers were not faster than reading one by one", pool_ns * 2 < serial_ns);
+	return 0;
+}
+
+static const char *test_aggregate() {
+	const int samples[] = { 45000, 61000, 38000, 52000, 40000 };
+	t_aggregation agg;
+	t_sensors *table = calloc(1, sizeof(t_sensors));
+
+	table->count = 5;
+	strcpy(table->label[1], "TC0P");
+	strcpy(table->label[3], "TC0D");
+
+	aggregation_init(&agg);
+	mu_assert("Mean is wrong", aggregate_temp(&agg, samples, 5) == 47200);
+
+	agg.method = AGGREGATE_MAX;
+	mu_assert("Max is wrong", aggregate_temp(&agg, samples, 5) == 61000);
+
+	agg.method = AGGREGATE_TOP_K;
+	agg.k = 2;
+	mu_assert("Top 2 mean is wrong", aggregate_temp(&agg, samples, 5) == 56500);
+	agg.k = 10;
+	mu_assert("Top k larger than the sensors is not the mean", aggregate_temp(&agg, samples, 5) == 47200);
+
+	agg.method = AGGREGATE_PERCENTILE;
+	agg.percentile = 50;
+	mu_assert("Median is wrong", aggregate_temp(&agg, samples, 5) == 45000);
+	agg.percentile = 100;
+	mu_assert("100th percentile is not the max", aggregate_temp(&agg, samples, 5) == 61000);
+	agg.percentile = 1;
+	mu_assert("1st percentile is not the min", aggregate_temp(&agg, samples, 5) == 38000);
+
+	agg.method = AGGREGATE_WEIGHTED;
+	mu_assert("Weights were not parsed", aggregation_parse_weights(&agg, "TC0P:4, TC0D : 0 ,TCXC:2") == 3);
+	aggregation_bind(&agg, table);
+	mu_assert("Weighted mean is wrong", aggregate_temp(&agg, samples, 5) == (45000 + 4 * 61000 + 38000 + 40000) / 7);
+
+	enum aggregation_method method = AGGREGATE_MEAN;
+	mu_assert("Known method was rejected", aggregation_parse_method("top_k", &method) && method == AGGREGATE_TOP_K);
+	mu_assert("Unknown method was accepted", !aggregation_parse_method("median", &method) && method == AGGREGATE_TOP_K);
+
+	free(table);
+	return 0;
+}
+
+static const char *test_fan_curve() {
+	int saved[] = { min_fan_speed, max_fan_speed, low_temp, high_temp, max_temp };
+
+	min_fan_speed = 2000;
+	max_fan_speed = 6000;
+	low_temp  = 30;
+	high_temp = 40;
+	max_temp  = 50;
+
+	// 2000 + 4000 * (5 * 6 / 2) / (10 * 11 / 2), rounded up
+	mu_assert("Rising curve is wrong at 45 degrees", curve_speed_up(45000) == 3091);
+	// 6000 - 4000 * (5 * 6 / 2) / (20 * 21 / 2), rounded down
+	mu_assert("Falling curve is wrong at 45 degrees", curve_speed_down(45000) == 5714);
+
+	mu_assert("Rising curve does not start at min_fan_speed", curve_speed_up(40000) == 2000);
+	mu_assert("Rising curve does not end at max_fan_speed", curve_speed_up(50000) == 6000);
+	mu_assert("Falling curve does not start at min_fan_speed", curve_speed_down(30000) == 2000);
+	mu_assert("Falling curve does not end at max_fan_speed", curve_speed_down(50000) == 6000);
+
+	int temp;
+
+	for (temp = 40001; temp <= 50000; temp++) {
+		mu_assert("Rising curve is not monotonic", curve_speed_up(temp) >= curve_speed_up(temp - 1));
+	}
+
+	for (temp = 30001; temp <= 50000; temp++) {
+		mu_assert("Falling curve is not monotonic", curve_speed_down(temp) >= curve_speed_down(temp - 1));
+	}
+
+	mu_assert("Sub-degree changes do not move the rising curve", curve_speed_up(45500) > curve_speed_up(45000));
+
+	min_fan_speed = saved[0];
+	max_fan_speed = saved[1];
+	low_temp  = saved[2];
+	high_temp = saved[3];
+	max_temp  = saved[4];
+	return 0;
+}
+
+static int read_fake_attribute(const char *name) {
+	char path[sizeof(fake_applesmc) + 32];
+	int value = -1;
+
+	snprintf(path, sizeof(path), "%s/%s", fake_applesmc, name);
+
+	FILE *file = fopen(path, "r");
+
+	if (file != NULL) {
+		if (fscanf(file, "%d", &value) != 1) {
+			value = -1;
+		}
+
+		fclose(file);
+	}
+
+	return value;
+}
+
+static const char *test_fan_write_suppression() {
+	int saved_deadband = fan_speed_deadband;
+	int saved_min = min_fan_speed;
+	int saved_max = max_fan_speed;
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(1, 2));
+
+	t_fans* fans = retrieve_fans();
+	min_fan_speed = 2000;
+	max_fan_speed = 6000;
+	fan_speed_deadband = 0;
+
+	set_fan_speed(fans, 3000);
+	set_fan_speed(fans, 3000);
+	mu_assert("Unchanged speed was written again", fans->writes_issued == 2 && fans->writes_suppressed == 2);
+	mu_assert("Speed was not written", read_fake_attribute("fan2_output") == 3000);
+
+	fan_speed_deadband = 100;
+	set_fan_speed(fans, 3100);
+	mu_assert("Speed within the deadband was written", fans->writes_issued == 2 && read_fake_attribute("fan1_output") == 3000);
+	set_fan_speed(fans, 3101);
+	mu_assert("Speed outside the deadband was not written", fans->writes_issued == 4 && read_fake_attribute("fan1_output") == 3101);
+	set_fan_speed(fans, 5950);
+	set_fan_speed(fans, 6000);
+	mu_assert("Deadband kept the speed from reaching its bound", fans->writes_issued == 8 && read_fake_attribute("fan1_output") == 6000);
+
+	set_fans_man(fans);
+	set_fan_speed(fans, 6000);
+	mu_assert("Speed was not written again after a mode change", fans->writes_issued == 10);
+
+	free_fans(fans);
+	remove_fake_applesmc();
+
+	fan_speed_deadband = saved_deadband;
+	min_fan_speed = saved_min;
+	max_fan_speed = saved_max;
+	return 0;
+}
+
+static const char *test_fan_limits() {
+	int saved_min = min_fan_speed;
+	int saved_max = max_fan_speed;
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(1, 3));
+	write_fake_attribute("fan1_min", 1200);
+	write_fake_attribute("fan1_max", 6200);
+	write_fake_attribute("fan2_min", 2000);
+	write_fake_attribute("fan2_max", 4000);
+
+	t_fans* fans = retrieve_fans();
+	min_fan_speed = 0;
+	max_fan_speed = 6000;
+
+	mu_assert("Fan limits were not read", fans->min_speed[0] == 1200 && fans->max_speed[1] == 4000);
+	mu_assert("Fan without limits got some", fans->min_speed[2] == 0 && fans->max_speed[2] == 0);
+
+	set_fan_speed(fans, 0);
+	mu_assert("Fans do not start at their own minimum", read_fake_attribute("fan1_output") == 1200 && read_fake_attribute("fan2_output") == 2000);
+
+	set_fan_speed(fans, 3000);
+	mu_assert("Half speed is not half of each fan range", read_fake_attribute("fan1_output") == 3700 && read_fake_attribute("fan2_output") == 3000);
+	mu_assert("Fan without limits does not follow the global range", read_fake_attribute("fan3_output") == 3000);
+
+	set_fan_speed(fans, 6000);
+	mu_assert("Fans do not end at their own maximum", read_fake_attribute("fan1_output") == 6200 && read_fake_attribute("fan2_output") == 4000);
+
+	mu_assert("Speed beyond the global range is not clamped", fan_target_speed(fans, 1, 9000) == 4000);
+
+	free_fans(fans);
+	remove_fake_applesmc();
+
+	min_fan_speed = saved_min;
+	max_fan_speed = saved_max;
+	return 0;
+}
+
+static const char *test_tach_feedback() {
+	int saved_checks = tach_checks;
+	int saved_tolerance = tach_tolerance;
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(1, 2));
+	write_fake_attribute("fan1_input", 0);
+	write_fake_attribute("fan2_input", 2950);
+
+	t_fans* fans = retrieve_fans();
+	tach_checks = 2;
+	tach_tolerance = 300;
+
+	set_fans_man(fans);
+	set_fan_speed(fans, 3000);
+
+	check_fans(fans);
+	mu_assert("Fan was reported before tach_checks", fans->stalls[0] == 0);
+
+	// The SMC took fan1 back
+	write_fake_attribute("fan1_manual", 0);
+
+	check_fans(fans);
+	mu_assert("Stalled fan was not reported", fans->stalls[0] == 1 && fans->lags[0] == 0);
+	mu_assert("Fan on target was reported", fans->stalls[1] == 0 && fans->lags[1] == 0);
+	mu_assert("Manual mode was not restored", fans->mode_reasserts[0] == 1 && read_fake_attribute("fan1_manual") == 1);
+	mu_assert("Speed is not written again after manual mode was restored", fans->last_written[0] == -1);
+
+	set_fan_speed(fans, 3000);
+	write_fake_attribute("fan1_input", 1500);
+	check_fans(fans);
+	check_fans(fans);
+	check_fans(fans);
+	mu_assert("Lagging fan was not reported once", fans->lags[0] == 1 && fans->stalls[0] == 1);
+	mu_assert("Manual mode was restored while still manual", fans->mode_reasserts[0] == 1);
+
+	free_fans(fans);
+	remove_fake_applesmc();
+
+	tach_checks = saved_checks;
+	tach_tolerance = saved_tolerance;
+	return 0;
+}
+
+/* First order thermal plant: 80 degrees with the fans off, 5 millidegrees
+ * cooler per RPM at equilibrium, reached with a 20 second time constant */
+static int plant_step(int temp, int speed, int dt_ms) {
+	int equilibrium = 80000 - 5 * speed;
+	return temp + (int)((long long)(equilibrium - temp) * dt_ms / (20000 + dt_ms));
+}
+
+static const char *test_pid() {
+	t_pid controller;
+	int temp = 70000;
+	int speed = 0;
+	int i;
+
+	pid_reset(&controller);
+	pid_configure(&controller, 60000, 400, 20, 0, 2, 1000, 6000);
+
+	for (i = 0; i < 600; i++) {
+		speed = pid_update(&controller, temp, 1000);
+		mu_assert("PID output is outside its clamp", speed >= 1000 && speed <= 6000);
+		temp = plant_step(temp, speed, 1000);
+	}
+
+	mu_assert("PID did not settle on its setpoint", abs(temp - 60000) < 250);
+	mu_assert("PID did not find the holding speed", abs(speed - 4000) < 100);
+
+	// Saturate for a long time, then cool down: the integral must not hold the fans up
+	pid_reset(&controller);
+
+	for (i = 0; i < 600; i++) {
+		pid_update(&controller, 90000, 1000);
+	}
+
+	mu_assert("PID is not saturated", pid_update(&controller, 90000, 1000) == 6000);
+
+	for (i = 0; i < 5; i++) {
+		speed = pid_update(&controller, 50000, 1000);
+	}
+
+	mu_assert("PID wound up while saturated", speed < 6000);
+
+	// Derivative acts on a rising temperature before the error grows
+	pid_configure(&controller, 60000, 0, 0, 1000, 0, 1000, 6000);
+	pid_reset(&controller);
+	pid_update(&controller, 50000, 1000);
+	mu_assert("Derivative did not react to a rising temperature", pid_update(&controller, 52000, 1000) == 3000);
+	return 0;
+}
+
+static const char *test_scheduler() {
+	t_scheduler scheduler;
+	struct timespec work = { .tv_sec = 0, .tv_nsec = 5000000L };
+	int i;
+
+	scheduler_init(&scheduler, 20);
+	long long start = monotonic_ns();
+
+	for (i = 0; i < 10; i++) {
+		mu_assert("Tick did not measure its interval", abs(scheduler_wait(&scheduler) - 20) <= 5);
+		nanosleep(&work, NULL);
+	}
+
+	long long drift_ms = (monotonic_ns() - start) / 1000000 - 205;
+	mu_assert("Ticks drifted by the work done in them", drift_ms >= -2 && drift_ms < 10);
+	mu_assert("Deadlines were missed without overrun", scheduler.missed == 0);
+
+	// Overrun three deadlines
+	struct timespec overrun = { .tv_sec = 0, .tv_nsec = 65000000L };
+	nanosleep(&overrun, NULL);
+
+	mu_assert("Overrun tick did not measure its real interval", scheduler_wait(&scheduler) >= 65);
+	mu_assert("Missed deadlines were not counted", scheduler.missed == 2);
+	mu_assert("Ticks were not counted", scheduler.ticks == 11);
+	return 0;
+}
+
+static const char *test_adaptive_polling() {
+	int saved[] = { adaptive_polling, polling_interval_ms, polling_interval_min_ms, polling_interval_max_ms, low_temp, high_temp };
+
+	polling_interval_ms     = 2000;
+	polling_interval_min_ms = 500;
+	polling_interval_max_ms = 10000;
+	low_temp  = 50;
+	high_temp = 60;
+
+	adaptive_polling = 0;
+	mu_assert("Interval adapted while disabled", next_polling_interval(2000, 30000, 0) == 2000);
+
+	adaptive_polling = 1;
+	mu_assert("Cold and stable did not stretch", next_polling_interval(2000, 30000, 10) == 4000);
+	mu_assert("Stretch went past the ceiling", next_polling_interval(8000, 30000, -10) == 10000);
+	mu_assert("Cold but heating did not go back to the base interval", next_polling_interval(8000, 30000, 200) == 2000);
+	mu_assert("Fast rise did not tighten", next_polling_interval(8000, 30000, 800) == 500);
+	mu_assert("Crossing high_temp did not tighten", next_polling_interval(2000, 61000, 0) == 500);
+	mu_assert("Between low_temp and high_temp is not the base interval", next_polling_interval(500, 55000, 0) == 2000);
+
+	adaptive_polling        = saved[0];
+	polling_interval_ms     = saved[1];
+	polling_interval_min_ms = saved[2];
+	polling_interval_max_ms = saved[3];
+	low_temp  = saved[4];
+	high_temp = saved[5];
+	return 0;
+}
+
+static const char *test_curve_table() {
+	int saved[] = { min_fan_speed, max_fan_speed, low_temp, high_temp, max_temp };
+	int configs[][5] = {
+		{ 2000, 6000, 30, 40, 50 },
+		{ 1299, 6199, 55, 63, 86 },  // step_up and step_down used to truncate to 11 and 4
+		{ 0,    6000, 20, 35, 50 },
+	};
+	unsigned int c;
+
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		min_fan_speed = configs[c][0];
+		max_fan_speed = configs[c][1];
+		low_temp  = configs[c][2];
+		high_temp = configs[c][3];
+		max_temp  = configs[c][4];
+
+		build_curve();
+
+		int temp;
+
+		// Each entry holds the curve at the next decidegree up
+		for (temp = low_temp * 1000; temp <= max_temp * 1000; temp += 7) {
+			int next = temp + CURVE_RESOLUTION < max_temp * 1000 ? temp + CURVE_RESOLUTION : max_temp * 1000;
+
+			mu_assert("Rising table is below the analytic curve", curve_up(&curve, temp) >= curve_speed_up(temp));
+			mu_assert("Rising table is above the next decidegree", curve_up(&curve, temp) <= curve_speed_up(next));
+			mu_assert("Falling table is below the analytic curve", curve_down(&curve, temp) >= curve_speed_down(temp));
+			mu_assert("Falling table is above the next decidegree", curve_down(&curve, temp) <= curve_speed_down(next));
+		}
+
+		for (temp = low_temp; temp <= max_temp; temp++) {
+			mu_assert("Rising table differs at a whole degree", curve_up(&curve, temp * 1000) == curve_speed_up(temp * 1000));
+			mu_assert("Falling table differs at a whole degree", curve_down(&curve, temp * 1000) == curve_speed_down(temp * 1000));
+		}
+
+		mu_assert("Table does not reach max_fan_speed", curve_up(&curve, max_temp * 1000 + 5000) == max_fan_speed);
+		mu_assert("Table does not start at min_fan_speed", curve_down(&curve, low_temp * 1000 - 5000) == min_fan_speed);
+	}
+
+	// Against the float formula, without the old truncation
+	min_fan_speed = 1299;
+	max_fan_speed = 6199;
+	low_temp  = 55;
+	high_temp = 63;
+	max_temp  = 86;
+	build_curve();
+
+	double step_up = (double)(max_fan_speed - min_fan_speed) / ((max_temp - high_temp) * (max_temp - high_temp + 1) / 2);
+	mu_assert("Rising table does not follow the exact step", curve_up(&curve, 70000) == (int) ceil(min_fan_speed + 28 * step_up));
+
+	min_fan_speed = saved[0];
+	max_fan_speed = saved[1];
+	low_temp  = saved[2];
+	high_temp = saved[3];
+	max_temp  = saved[4];
+	build_curve();
+	return 0;
+}
+
+static const char *test_curve_points() {
+	t_curve_points points;
+	int temp;
+	int last;
+
+	retrieve_settings("./mbpfan.conf.test2");
+	mu_assert("Curve section was not read", curve_points.count == 4);
+	mu_assert("Curve interpolation is not cubic", curve_points.interpolation == CURVE_CUBIC);
+	mu_assert("Decimal curve temp was not read", curve_points.temp[2] == 60500);
+	mu_assert("Curve speed was not clamped to max_fan_speed", curve_points.speed[3] == 6000);
+	mu_assert("Table does not span the points", curve.base == 40000 && curve.top == 80000);
+
+	// Monotone between the points, flat where they are
+	last = curve_up(&curve, 35000);
+	mu_assert("Curve does not hold its first speed below it", last == 2000);
+
+	for (temp = 35000; temp <= 85000; temp += 50) {
+		int speed = curve_up(&curve, temp);
+
+		mu_assert("Cubic curve is not monotone", speed >= last);
+		mu_assert("Cubic curve overshoots", speed >= 2000 && speed <= 6000);
+		mu_assert("Rising and falling branches differ", speed == curve_down(&curve, temp));
+		last = speed;
+	}
+
+	mu_assert("Cubic curve rises over a flat segment", curve_up(&curve, 45000) == 2000);
+	mu_assert("Cubic curve misses a point", curve_up(&curve, 60500) == 4000);
+	mu_assert("Curve does not hold its last speed above it", curve_up(&curve, 90000) == 6000);
+
+	// Hysteresis as with the triangle
+	mu_assert("Rising temperature does not follow the curve", triangle_speed(2000, 60500, 100) == 4000);
+	mu_assert("Rising temperature lowered the speed", triangle_speed(5000, 60500, 100) == 5000);
+	mu_assert("Falling temperature does not follow the curve", triangle_speed(5000, 60500, -100) == 4000);
+
+	points.temp[0]  = 40000;
+	points.temp[1]  = 60000;
+	points.temp[2]  = 80000;
+	points.speed[0] = 2000;
+	points.speed[1] = 4000;
+	points.speed[2] = 3000;
+	points.interpolation = CURVE_LINEAR;
+
+	mu_assert("Linear curve was rejected", curve_points_prepare(&points, 3));
+	mu_assert("Linear curve is off the first segment", curve_points_speed(&points, 50000) == 3000);
+	mu_assert("Linear curve is off the second segment", curve_points_speed(&points, 70000) == 3500);
+
+	points.interpolation = CURVE_CUBIC;
+	mu_assert("Cubic curve was rejected", curve_points_prepare(&points, 3));
+	mu_assert("Cubic curve overshoots a peak", curve_points_speed(&points, 59000) <= 4000 && curve_points_speed(&points, 61000) <= 4000);
+
+	points.temp[1] = 40000;
+	mu_assert("Repeated temperature was accepted", !curve_points_prepare(&points, 3));
+	mu_assert("Single point was accepted", !curve_points_prepare(&points, 1));
+
+	retrieve_settings("./mbpfan.conf");
+	mu_assert("Curve remained without a curve section", curve_points.count == 0);
+	mu_assert("Table is not the triangle again", curve.base == low_temp * 1000 && curve.top == max_temp * 1000);
+	return 0;
+}
+
+static const char *test_estimator() {
+	t_estimator est;
+	int sample;
+	int previous = 0;
+	int previous_sample = 0;
+	int raw_falls = 0;
+	int predicted_falls = 0;
+	int tick;
+
+	estimator_configure(&est, 0.3, 0.05, 5);
+	estimator_reset(&est);
+
+	sample = 50000;
+	estimator_update(&est, &sample, 1, 0);
+	mu_assert("First sample is not taken as is", est.predicted[0] == 50000);
+
+	for (tick = 0; tick < 10; tick++) {
+		estimator_update(&est, &sample, 1, 1000);
+	}
+
+	mu_assert("Constant temperature drifted", est.predicted[0] == 50000);
+
+	// 0.3 degrees per second, with samples alternately 0.4 degrees off
+	estimator_reset(&est);
+
+	for (tick = 0; tick < 60; tick++) {
+		int truth = 40000 + 300 * tick;
+		sample = truth + (tick % 2 ? 400 : -400);
+
+		estimator_update(&est, &sample, 1, 1000);
+
+		if (tick > 20) {
+			raw_falls       += sample < previous_sample;
+			predicted_falls += est.predicted[0] < previous;
+		}
+
+		previous        = est.predicted[0];
+		previous_sample = sample;
+	}
+
+	mu_assert("Noise did not make the samples fall", raw_falls > 15);
+	mu_assert("Noise made the prediction fall while heating up", predicted_falls == 0);
+	mu_assert("Prediction is not ahead of the ramp", est.predicted[0] > 40000 + 300 * 59 + 1000);
+
+	// A clean ramp of 1 degree per second is predicted 5 seconds ahead
+	estimator_reset(&est);
+
+	for (tick = 0; tick < 60; tick++) {
+		sample = 40000 + 1000 * tick;
+		estimator_update(&est, &sample, 1, 1000);
+	}
+
+	mu_assert("Rate of a clean ramp is off", est.rate[0] > 990000 && est.rate[0] < 1010000);
+	mu_assert("Prediction of a clean ramp is off", abs(est.predicted[0] - (sample + 5000)) <= 50);
+
+	// Changing the sensors starts over
+	int samples[2] = { 30000, 31000 };
+	estimator_update(&est, samples, 2, 1000);
+	mu_assert("New sensors did not start over", est.predicted[0] == 30000 && est.predicted[1] == 31000);
+	return 0;
+}
+
+static const char *test_zones() {
+	int samples[3];
+	int speeds[FANS_MAX];
+	char path[sizeof(fake_applesmc) + 32];
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(3, 3));
+
+	snprintf(path, sizeof(path), "%s/temp1_label", fake_applesmc);
+	FILE *file = fopen(path, "w");
+	mu_assert("Could not write a sensor label", file != NULL);
+	fprintf(file, "TC0P\n");
+	fclose(file);
+
+	t_sensors* sensors = retrieve_sensors();
+	t_fans* fans = retrieve_fans();
+
+	retrieve_settings("./mbpfan.conf.test3");
+	mu_assert("Zones were not read", zone_count == 2);
+	mu_assert("Zone selectors were not resolved", zone_bind(&zones[0], sensors, fans) && zone_bind(&zones[1], sensors, fans));
+	mu_assert("Zone does not hold its sensors", zones[0].sensor_count == 2 && zones[0].sensor[0] == 0 && zones[0].sensor[1] == 1);
+	mu_assert("Zone does not hold its fans", zones[0].fan_count == 2 && zones[1].fan_count == 1 && zones[1].fan[0] == 1);
+	mu_assert("Zone does not use its own aggregation", zones[0].aggregation.method == AGGREGATE_MAX && zones[1].aggregation.method == AGGREGATE_MEAN);
+	mu_assert("Zone does not use its own curve", zones[1].points.count == 2 && zones[0].points.count == 0);
+
+	// A hot GPU only spins the fan over it
+	samples[0] = 35000;
+	samples[1] = 35000;
+	samples[2] = 80000;
+	zone_update(&zones[0], samples);
+	zone_update(&zones[1], samples);
+	zones_arbitrate(zones, zone_count, 3000, speeds, fans->count);
+	set_fan_speeds(fans, speeds);
+
+	mu_assert("Hot GPU spun the CPU fan", read_fake_attribute("fan1_output") == 2000);
+	mu_assert("Hot GPU did not spin its fan", read_fake_attribute("fan2_output") == 6000);
+	mu_assert("Fan in no zone does not follow the main controller", read_fake_attribute("fan3_output") == 3000);
+
+	// One hot CPU sensor is not averaged down, and the shared fan takes the highest demand
+	samples[0] = 58000;
+	samples[2] = 55000;
+	zone_update(&zones[0], samples);
+	zone_update(&zones[1], samples);
+	zones_arbitrate(zones, zone_count, 3000, speeds, fans->count);
+	set_fan_speeds(fans, speeds);
+
+	mu_assert("CPU zone was averaged down", zones[0].temp == 58000);
+	mu_assert("GPU zone did not come down", zones[1].speed == 4000);
+	mu_assert("CPU fan does not follow its zone", read_fake_attribute("fan1_output") == zones[0].speed && zones[0].speed > 4000);
+	mu_assert("Shared fan does not take the highest demand", read_fake_attribute("fan2_output") == zones[0].speed);
+
+	retrieve_settings("./mbpfan.conf");
+	mu_assert("Zones remained without a zones setting", zone_count == 0);
+
+	free_fans(fans);
+	free_sensors(sensors);
+	remove_fake_applesmc();
+	return 0;
+}
+
+/* A first order plus dead time thermal plant: settles at 80 degrees
+ * less 5 per 1000 RPM, with a 60 s time constant and 5 s dead time */
+struct s_thermal_sim {
+	double temp;       // degrees
+	double now_ms;
+	int speed;         // acting on the temperature
+	int next_speed;    // acting from switch_ms on
+	double switch_ms;
+	unsigned int reads;
+};
+
+static void sim_set_speed(void *ctx, int speed) {
+	struct s_thermal_sim *sim = ctx;
+	sim->next_speed = speed;
+	sim->switch_ms  = sim->now_ms + 5000;
+}
+
+static int sim_read_temp(void *ctx) {
+	struct s_thermal_sim *sim = ctx;
+
+	// Sensor noise of 0.05 degrees
+	return (int)(sim->temp * 1000) + (sim->reads++ % 2 ? 50 : -50);
+}
+
+static void sim_wait(void *ctx, int ms) {
+	struct s_thermal_sim *sim = ctx;
+	int step;
+
+	for (step = 0; step < ms; step += 10) {
+		if (sim->now_ms >= sim->switch_ms) {
+			sim->speed = sim->next_speed;
+		}
+
+		sim->temp   += (80 - 0.005 * sim->speed - sim->temp) / 60.0 * 0.01;
+		sim->now_ms += 10;
+	}
+}
+
+static const char *test_autotune() {
+	struct s_thermal_sim sim = { .temp = 75, .speed = 2000, .next_speed = 2000 };
+	t_autotune_plant plant = { sim_set_speed, sim_read_temp, sim_wait, &sim };
+	t_autotune_model model;
+	t_autotune at;
+	double kp, ki, kd;
+
+	autotune_init(&at, 2000, 6000, 90000);
+	mu_assert("Autotuning the simulated plant failed", autotune_run(&at, &plant, &model) == 0);
+
+	mu_assert("Gain is off", fabs(model.gain + 0.005) < 0.0005);
+	mu_assert("Time constant is off", fabs(model.tau - 60) < 9);
+	mu_assert("Dead time is off", fabs(model.dead_time - 5) < 3);
+	mu_assert("Settled temperatures are off", abs(model.temp_before - 50000) < 500 && abs(model.temp_after - 70000) < 500);
+	mu_assert("Fans were not left fast", sim.next_speed == 6000);
+
+	autotune_pid(&model, &kp, &ki, &kd);
+	mu_assert("PID gains are not positive", kp > 0 && ki > 0 && kd == 0);
+	mu_assert("Proportional gain is off", kp > 450 && kp < 800);
+
+	// The step is called off before the plant gets too hot
+	sim.temp = 50;
+	sim.speed = sim.next_speed = 6000;
+	autotune_init(&at, 2000, 6000, 60000);
+	mu_assert("Autotuning went past abort_temp", autotune_run(&at, &plant, &model) == -ERANGE);
+	mu_assert("Fans were not left fast after an abort", sim.next_speed == 6000);
+	mu_assert("Autotuning overshot abort_temp", sim.temp < 61);
+
+	// Written back next to the existing settings
+	char path[] = "/tmp/mbpfan-test-XXXXXX";
+	char bak_path[sizeof(path) + 4];
+	int fd = mkstemp(path);
+	mu_assert("Could not create a settings file", fd != -1);
+
+	FILE *file = fdopen(fd, "w");
+	fprintf(file, "# tuned by hand\n[general]\nmin_fan_speed = 2000\ncontrol_mode = triangle\npid_kp = 400  # RPM per degree\n#[curve]\n");
+	fclose(file);
+
+	mu_assert("Could not save the gains", autotune_save(path, &model, 1234.5, 20.25, 0) == 0);
+
+	file = fopen(path, "r");
+	Settings *settings = settings_open(file);
+	fclose(file);
+
+	mu_assert("Saved settings do not parse", settings != NULL);
+	mu_assert("Existing setting was lost", settings_get_int(settings, "general", "min_fan_speed") == 2000);
+	mu_assert("Gain was not saved", settings_get_double(settings, "general", "pid_kp") == 1234.5);
+	mu_assert("Model was not saved", settings_get_double(settings, "autotune", "time_constant") > 0);
+
+	char value[16];
+	mu_assert("Control mode was not switched", settings_get(settings, "general", "control_mode", value, sizeof(value)) && strcmp(value, "pid") == 0);
+	settings_delete(settings);
+
+	// Everything else stays as it was written
+	char saved[512];
+	file = fopen(path, "r");
+	size_t n = fread(saved, 1, sizeof(saved) - 1, file);
+	fclose(file);
+	saved[n] = '\0';
+	mu_assert("Comments were dropped", strstr(saved, "# tuned by hand\n") == saved && strstr(saved, "\n#[curve]\n") != NULL);
+	mu_assert("Gain was not written in place", strstr(saved, "\npid_kp = 1234.5 # RPM per degree\n") != NULL);
+
+	snprintf(bak_path, sizeof(bak_path), "%s.bak", path);
+	mu_assert("Previous settings were not kept", access(bak_path, F_OK) == 0);
+
+	unlink(bak_path);
+	unlink(path);
+	return 0;
+}
+
+static void pipe_handler(int fd, void *ctx) {
+	char byte;
+
+	if (read(fd, &byte, 1) == 1) {
+		(*(int *) ctx)++;
+	}
+}
+
+static const char *test_loop() {
+	t_loop loop;
+	int pipe_fds[2];
+	int handled = 0;
+
+	mu_assert("Could not set up the event loop", loop_init(&loop) == 0);
+
+	// Blocked signals wait in the signalfd instead of interrupting anything
+	raise(SIGHUP);
+	raise(SIGTERM);
+	mu_assert("Shutdown did not come first", loop_wait(&loop) == LOOP_EXIT);
+	mu_assert("Reload was lost", loop_wait(&loop) == LOOP_RELOAD);
+
+	long long start = monotonic_ns();
+	loop_arm(&loop, start + 20000000LL);
+	mu_assert("Timer did not fire", loop_wait(&loop) == LOOP_TIMER);
+	mu_assert("Timer fired early", monotonic_ns() - start >= 20000000LL);
+
+	// Deadlines already past fire at once
+	loop_arm(&loop, start);
+	mu_assert("Past deadline did not fire", loop_wait(&loop) == LOOP_TIMER);
+
+	mu_assert("Could not create a pipe", pipe(pipe_fds) == 0);
+	mu_assert("Could not watch a pipe", loop_watch(&loop, pipe_fds[0], pipe_handler, &handled) == 0);
+
+	mu_assert("Could not write to the pipe", write(pipe_fds[1], "x", 1) == 1);
+	loop_arm(&loop, monotonic_ns() + 50000000LL);
+	mu_assert("Timer did not fire after the pipe", loop_wait(&loop) == LOOP_TIMER);
+	mu_assert("Pipe handler was not run", handled == 1);
+
+	loop_request(&loop, LOOP_RELOAD);
+	mu_assert("Requested reload was not returned", loop_wait(&loop) == LOOP_RELOAD);
+
+	loop_unwatch(&loop, pipe_fds[0]);
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+
+	loop_exit(&loop);
 	return 0;
 }
 
@@ -161,23 +1124,577 @@ static const char *test_settings_reload() {
 	retrieve_settings("./mbpfan.conf");
 	printf("Testing the _supplied_ mbpfan.conf (not the one you are using)..\n");
 	mu_assert("min_fan_speed value is not 2000 before SIGHUP", min_fan_speed == 2000);
-	mu_assert("polling_interval is not 7 before SIHUP", polling_interval == 7);
+	mu_assert("polling_interval is not 7 before SIHUP", polling_interval_ms == 7000);
 	raise(SIGHUP);
 	mu_assert("min_fan_speed value is not 5600 after SIGHUP", min_fan_speed == 5600);
-	mu_assert("polling_interval is not 1 after SIHUP", polling_interval == 1);
+	mu_assert("polling_interval is not 1 after SIHUP", polling_interval_ms == 1000);
+	retrieve_settings("./mbpfan.conf");
+	return 0;
+}
+
+
+static const char *test_settings_rejected() {
+	retrieve_settings("./mbpfan.conf");
+
+	int low   = low_temp;
+	int high  = high_temp;
+	int speed = max_fan_speed;
+	int interval = polling_interval_ms;
+	int mode  = control_mode;
+	int full  = curve_up(&curve, max_temp * 1000);
+
+	mu_assert("Invalid settings were accepted", !retrieve_settings("./mbpfan.conf.test4"));
+	mu_assert("Invalid settings changed the temperatures", low_temp == low && high_temp == high);
+	mu_assert("Invalid settings changed the fan speeds", max_fan_speed == speed);
+	mu_assert("Invalid settings changed the polling interval", polling_interval_ms == interval);
+	mu_assert("Invalid settings changed the control mode", control_mode == mode);
+	mu_assert("Invalid settings changed the curve", curve_points.count == 0 && curve_up(&curve, max_temp * 1000) == full);
+
+	mu_assert("Valid settings were rejected", retrieve_settings("./mbpfan.conf.test1"));
+	mu_assert("Valid settings were not applied", low_temp == 40 && high_temp == 45 && max_fan_speed == 5600);
+	mu_assert("Curve was not rebuilt with the settings", curve_up(&curve, 50000) == 5600);
+
 	retrieve_settings("./mbpfan.conf");
 	return 0;
 }
 
+static int write_text_file(const char *path, const char *text) {
+	FILE *file = fopen(path, "w");
+
+	if (file == NULL) {
+		return 0;
+	}
+
+	fputs(text, file);
+	return fclose(file) == 0;
+}
+
+static const char *test_config_watch() {
+	t_watch watch;
+	char dir[] = "/tmp/mbpfan-watch-XXXXXX";
+	char path[sizeof(dir) + 16];
+	char tmp_path[sizeof(dir) + 16];
+
+	mu_assert("Could not create a directory", mkdtemp(dir) != NULL);
+	snprintf(path, sizeof(path), "%s/mbpfan.conf", dir);
+	snprintf(tmp_path, sizeof(tmp_path), "%s/mbpfan.tmp", dir);
+
+	mu_assert("Could not write a config", write_text_file(path, "[general]\nlow_temp = 40\n"));
+	mu_assert("Could not watch the config", watch_init(&watch, path) == 0);
+	mu_assert("Watch started with a change due", watch.due_ns == 0);
+
+	// Rewritten with the same content: the events arrive, the reload does not
+	mu_assert("Could not rewrite the config", write_text_file(path, "[general]\nlow_temp = 40\n"));
+	watch_read(watch.fd, &watch);
+	mu_assert("Rewrite was not noticed", watch.due_ns != 0);
+	mu_assert("Changes were not debounced", watch.due_ns > monotonic_ns());
+	mu_assert("Unchanged content counted as a change", !watch_changed(&watch));
+	mu_assert("Change stayed due", watch.due_ns == 0);
+
+	// Replaced by a rename, as editors do, and still followed afterwards
+	mu_assert("Could not write a new config", write_text_file(tmp_path, "[general]\nlow_temp = 45\n"));
+	mu_assert("Could not rename the new config", rename(tmp_path, path) == 0);
+	watch_read(watch.fd, &watch);
+	mu_assert("Rename was not noticed", watch.due_ns != 0);
+	mu_assert("New content was not a change", watch_changed(&watch));
+
+	mu_assert("Could not edit the config", write_text_file(path, "[general]\nlow_temp = 50\n"));
+	watch_read(watch.fd, &watch);
+	mu_assert("Renamed config was no longer watched", watch.due_ns != 0 && watch.file_wd != -1);
+	mu_assert("Edit was not a change", watch_changed(&watch));
+
+	// Other files of the directory do not matter
+	mu_assert("Could not write another file", write_text_file(tmp_path, "other"));
+	watch_read(watch.fd, &watch);
+	mu_assert("Another file was taken for the config", watch.due_ns == 0);
+
+	watch_exit(&watch);
+	unlink(tmp_path);
+	unlink(path);
+	rmdir(dir);
+	return 0;
+}
+
+static int overridden_speed = -1;
+static char switched_profile[64];
+
+static int record_override(void *ctx, int speed, int seconds) {
+	(void) ctx;
+	overridden_speed = seconds > 0 ? speed : 0;
+	return 0;
+}
+
+static int record_profile(void *ctx, const char *path) {
+	(void) ctx;
+	snprintf(switched_profile, sizeof(switched_profile), "%s", path);
+	return strcmp(path, "/invalid.conf") == 0 ? -EINVAL : 0;
+}
+
+static const char *test_control() {
+	t_control control;
+	t_control_ops ops = { .override = record_override, .profile = record_profile, .ctx = NULL };
+	char path[64];
+	char reply[CONTROL_MESSAGE_MAX];
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(2, 1));
+	sensors = retrieve_sensors();
+	fans = retrieve_fans();
+
+	snprintf(path, sizeof(path), "/tmp/mbpfan-control-%d.sock", (int) getpid());
+	memset(&control, 0, sizeof(control));
+	control.profile = "/etc/mbpfan.conf";
+	mu_assert("Could not listen", control_init(&control, path, &ops) == 0);
+
+	control.state.temp  = 51250;
+	control.state.speed = 2400;
+	control_handle(&control, "state", 0);
+	mu_assert("State does not hold the temperature", strstr(control.reply, "ok temp=51250 speed=2400 ") == control.reply);
+	mu_assert("State does not hold the profile", strstr(control.reply, "profile=/etc/mbpfan.conf") != NULL);
+
+	sensors->temperature[1] = 47500;
+	control_handle(&control, "sensors", 0);
+	mu_assert("Sensors were not listed", strncmp(control.reply, "ok 2\n", 5) == 0 && strstr(control.reply, " 47500 0") != NULL);
+
+	control_handle(&control, "fans", 0);
+	mu_assert("Fans were not listed", strncmp(control.reply, "ok 1\n", 5) == 0);
+
+	// Only root changes anything
+	control_handle(&control, "override 4000 60", 0);
+	mu_assert("Unprivileged override was taken", strncmp(control.reply, "error", 5) == 0 && overridden_speed == -1);
+
+	control_handle(&control, "override 4000 60", 1);
+	mu_assert("Override was not taken", strcmp(control.reply, "ok") == 0 && overridden_speed == 4000);
+
+	control_handle(&control, "override off", 1);
+	mu_assert("Override was not released", strcmp(control.reply, "ok") == 0 && overridden_speed == 0);
+
+	control_handle(&control, "override fast", 1);
+	mu_assert("Malformed override was taken", strncmp(control.reply, "error", 5) == 0);
+
+	control_handle(&control, "profile relative.conf", 1);
+	mu_assert("Relative profile was taken", strncmp(control.reply, "error", 5) == 0);
+
+	control_handle(&control, "profile /invalid.conf", 1);
+	mu_assert("Rejected profile was reported as loaded", strncmp(control.reply, "error", 5) == 0);
+
+	control_handle(&control, "profile /etc/quiet.conf", 1);
+	mu_assert("Profile was not switched", strcmp(control.reply, "ok") == 0 && strcmp(switched_profile, "/etc/quiet.conf") == 0);
+
+	control_handle(&control, "reboot", 1);
+	mu_assert("Unknown request was answered", strncmp(control.reply, "error", 5) == 0);
+
+	// A real round trip through the socket, without blocking the reader
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	sa_family_t family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	int client = socket(AF_UNIX, SOCK_DGRAM, 0);
+	mu_assert("Could not create a client", client != -1);
+	mu_assert("Could not bind the client", bind(client, (struct sockaddr *) &family, sizeof(family)) == 0);
+	mu_assert("Could not connect the client", connect(client, (struct sockaddr *) &address, sizeof(address)) == 0);
+	mu_assert("Could not send a request", send(client, "state", 5, 0) == 5);
+
+	control_read(control.fd, &control);
+	control_read(control.fd, &control);
+
+	ssize_t n = recv(client, reply, sizeof(reply) - 1, MSG_DONTWAIT);
+	mu_assert("No reply came back", n > 0);
+	reply[n] = '\0';
+	mu_assert("Reply was not the state", strncmp(reply, "ok temp=51250", 13) == 0);
+	close(client);
+
+	// Nobody reads the socket: the client gives up
+	mu_assert("Unanswered query did not time out", control_query(path, "state", reply, sizeof(reply), 50) == -ETIMEDOUT);
+
+	control_exit(&control);
+	mu_assert("Socket was left behind", access(path, F_OK) != 0);
+	mu_assert("Query of a stopped daemon did not fail", control_query(path, "state", reply, sizeof(reply), 50) < 0);
+
+	free_fans(fans);
+	fans = NULL;
+	free_sensors(sensors);
+	sensors = NULL;
+	remove_fake_applesmc();
+	return 0;
+}
+
+struct s_torn_check {
+	const t_telemetry *segment;
+	volatile int stop;
+	unsigned long snapshots;
+	unsigned long torn;
+};
+
+/* Every tick writes the same value everywhere, so a mixed snapshot is a torn one */
+static void *read_telemetry(void *arg) {
+	struct s_torn_check *check = arg;
+	t_telemetry snapshot;
+	unsigned int i;
+
+	while (!check->stop) {
+		if (telemetry_read(check->segment, &snapshot) != 0) {
+			continue;
+		}
+
+		check->snapshots++;
+
+		for (i = 0; i < snapshot.sensor_count; i++) {
+			if (snapshot.sensor_temp[i] != snapshot.temp) {
+				check->torn++;
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static const char *test_telemetry() {
+	const t_telemetry *segment;
+	t_telemetry snapshot;
+	t_scheduler scheduler;
+	struct s_torn_check check;
+	pthread_t reader;
+	char path[64];
+	char victim[80];
+	struct stat info;
+	unsigned int i;
+	int tick;
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(SENSORS_MAX, 2));
+	t_sensors *sensors = retrieve_sensors();
+	t_fans *fans = retrieve_fans();
+
+	snprintf(path, sizeof(path), "/tmp/mbpfan-telemetry-%d", (int) getpid());
+	mu_assert("Attached to a missing segment", telemetry_attach(path, &segment) == -ENOENT);
+
+	// A link planted at the path is replaced, not followed
+	snprintf(victim, sizeof(victim), "%s.victim", path);
+	FILE *file = fopen(victim, "w");
+	mu_assert("Could not create the link target", file != NULL);
+	fputs("keep", file);
+	fclose(file);
+	mu_assert("Could not plant a link", symlink(victim, path) == 0);
+
+	mu_assert("Could not create the segment", telemetry_init(path, sensors, fans) == 0);
+	mu_assert("Segment is not active", telemetry_active());
+	mu_assert("Link was followed", stat(victim, &info) == 0 && info.st_size == 4);
+	mu_assert("Link was kept", lstat(path, &info) == 0 && S_ISREG(info.st_mode));
+	unlink(victim);
+
+	scheduler_init(&scheduler, 1000);
+	scheduler.ticks = 7;
+	sensors->temperature[0] = 45000;
+	fans->last_written[1] = 3300;
+	telemetry_publish(sensors, fans, &scheduler, 1000, 46000, 47000, 3300);
+
+	mu_assert("Could not attach to the segment", telemetry_attach(path, &segment) == 0);
+	mu_assert("Could not read a snapshot", telemetry_read(segment, &snapshot) == 0);
+	mu_assert("Snapshot lost the tables", snapshot.sensor_count == sensors->count && snapshot.fan_count == fans->count);
+	mu_assert("Snapshot lost the tick", snapshot.ticks == 7 && snapshot.elapsed_ms == 1000 && snapshot.monotonic_ns > 0);
+	mu_assert("Snapshot lost the temperatures", snapshot.temp == 46000 && snapshot.control_temp == 47000 && snapshot.sensor_temp[0] == 45000);
+	mu_assert("Snapshot lost the fans", snapshot.speed == 3300 && snapshot.fan_speed[1] == 3300);
+	mu_assert("Snapshot lost the sensor indexes", snapshot.sensor_index[0] == sensors->index[0]);
+
+	// Readers never keep a tick caught halfway
+	check.segment   = segment;
+	check.stop      = 0;
+	check.snapshots = 0;
+	check.torn      = 0;
+	mu_assert("Could not start a reader", pthread_create(&reader, NULL, read_telemetry, &check) == 0);
+
+	for (tick = 0; tick < 200000; tick++) {
+		for (i = 0; i < sensors->count; i++) {
+			sensors->temperature[i] = tick;
+		}
+
+		telemetry_publish(sensors, fans, &scheduler, 1000, tick, tick, 0);
+	}
+
+	check.stop = 1;
+	pthread_join(reader, NULL);
+
+	printf("Took %lu snapshots, %lu torn\n", check.snapshots, check.torn);
+	mu_assert("Reader took no snapshot", check.snapshots > 0);
+	mu_assert("Reader kept a torn snapshot", check.torn == 0);
+	telemetry_detach(segment);
+
+	// Readers only trust a segment root owns
+	mu_assert("Could not hand the segment over", chown(path, 65534, 65534) == 0);
+	mu_assert("Attached to a segment of another user", telemetry_attach(path, &segment) == -EPERM);
+
+	telemetry_exit();
+	mu_assert("Segment was left behind", access(path, F_OK) != 0);
+
+	free_fans(fans);
+	free_sensors(sensors);
+	remove_fake_applesmc();
+	return 0;
+}
+
+static const char *test_metrics() {
+	t_scheduler scheduler;
+	char path[64];
+	char text[METRICS_BUFFER_MAX];
+	size_t length;
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(SENSORS_MAX, 2));
+	t_sensors *sensors = retrieve_sensors();
+	t_fans *fans = retrieve_fans();
+
+	snprintf(sensors->label[0], LABEL_LEN, "TC\"0P");
+	sensors->label[1][0] = '\0';
+	sensors->temperature[0] = 51250;
+	sensors->temperature[1] = -500;
+	sensors->read_errors[1] = 3;
+	fans->last_written[0]   = 2400;
+
+	scheduler_init(&scheduler, 1000);
+	scheduler.ticks = 3;
+	metrics_tick(&scheduler, 80000, 50000, 2400);    // 80 us
+	metrics_tick(&scheduler, 3000000, 50000, 2400);  // 3 ms
+	metrics_tick(&scheduler, 2000000000, 52500, 2600);  // 2 s
+	metrics_reload(1);
+	metrics_reload(0);
+
+	const char *rendered = metrics_render(sensors, fans, &length);
+	mu_assert("Metrics were not rendered", length > 0 && strlen(rendered) == length);
+	mu_assert("Metrics were truncated", length < METRICS_BUFFER_MAX - 1);
+	mu_assert("Ticks are missing", strstr(rendered, "\nmbpfan_ticks_total 3\n") != NULL);
+	mu_assert("Histogram is not cumulative", strstr(rendered, "mbpfan_tick_duration_seconds_bucket{le=\"0.000100\"} 1\n") != NULL
+		&& strstr(rendered, "mbpfan_tick_duration_seconds_bucket{le=\"0.005000\"} 2\n") != NULL
+		&& strstr(rendered, "mbpfan_tick_duration_seconds_bucket{le=\"+Inf\"} 3\n") != NULL);
+	mu_assert("Histogram sum is wrong", strstr(rendered, "mbpfan_tick_duration_seconds_sum 2.003080000\n") != NULL);
+	mu_assert("Gauges are missing", strstr(rendered, "\nmbpfan_temperature_celsius 52.500\n") != NULL && strstr(rendered, "\nmbpfan_speed_rpm 2600\n") != NULL);
+	mu_assert("Reloads are missing", strstr(rendered, "mbpfan_reloads_total{result=\"rejected\"} 1\n") != NULL);
+	mu_assert("Sensor label was not escaped", strstr(rendered, "mbpfan_sensor_temperature_celsius{sensor=\"TC\\\"0P\",index=\"1\"} 51.250\n") != NULL);
+	mu_assert("Unlabeled sensor was not named", strstr(rendered, "{sensor=\"temp2\",index=\"2\"} -0.500\n") != NULL);
+	mu_assert("Read errors are missing", strstr(rendered, "mbpfan_sensor_read_errors_total{sensor=\"temp2\",index=\"2\"} 3\n") != NULL);
+	mu_assert("Fan speed is missing", strstr(rendered, "mbpfan_fan_speed_rpm{fan=\"fan1\",index=\"1\"} 2400\n") != NULL);
+
+	snprintf(path, sizeof(path), "/tmp/mbpfan-metrics-%d.prom", (int) getpid());
+	mu_assert("Could not write the textfile", metrics_write(path, sensors, fans) == 0);
+
+	FILE *file = fopen(path, "r");
+	mu_assert("Textfile is missing", file != NULL);
+	size_t read = fread(text, 1, sizeof(text) - 1, file);
+	text[read] = '\0';
+	fclose(file);
+
+	mu_assert("Textfile differs from the metrics", read == length && strstr(text, "mbpfan_ticks_total 3") != NULL);
+
+	snprintf(text, sizeof(text), "%s.tmp", path);
+	mu_assert("Temporary textfile was left behind", access(text, F_OK) != 0);
+	mu_assert("Unwritable textfile was reported as written", metrics_write("/nonexistent/mbpfan.prom", sensors, fans) == -ENOENT);
+
+	unlink(path);
+	free_fans(fans);
+	free_sensors(sensors);
+	remove_fake_applesmc();
+	return 0;
+}
+
+#define HISTORY_TEST_ROWS 3000
+
+struct s_history_check {
+	unsigned int rows;
+	unsigned int mismatches;
+	unsigned int files;
+	long long last_ms;
+};
+
+/* Row r holds r + column in every column, see test_history() */
+static void check_history_row(const t_history_header *header, int first, long long time_ms, const int32_t *values, void *ctx) {
+	struct s_history_check *check = ctx;
+	unsigned int columns = header->sensor_count + header->fan_count;
+	unsigned int i;
+
+	check->files += first;
+
+	for (i = 0; i < columns; i++) {
+		int32_t expected = i < header->sensor_count ? 40000 + (int32_t)(check->rows % 50) * 125 + (int32_t) i : 2000 + (int32_t)(check->rows / 100) * 10;
+
+		if (values[i] != expected) {
+			check->mismatches++;
+			break;
+		}
+	}
+
+	if (time_ms < check->last_ms) {
+		check->mismatches++;
+	}
+
+	check->last_ms = time_ms;
+	check->rows++;
+}
+
+static void fill_history_row(t_sensors *sensors, t_fans *fans, unsigned int row) {
+	unsigned int i;
+
+	for (i = 0; i < sensors->count; i++) {
+		sensors->temperature[i] = 40000 + (int)(row % 50) * 125 + (int) i;
+	}
+
+	for (i = 0; i < fans->count; i++) {
+		fans->last_written[i] = 2000 + (int)(row / 100) * 10;
+	}
+}
+
+static const char *test_history() {
+	struct s_history_check check;
+	struct stat info;
+	char path[64];
+	char rotated[80];
+	unsigned int row;
+	int i;
+
+	mu_assert("Could not create a fake applesmc directory", make_fake_applesmc(16, 2));
+	t_sensors *sensors = retrieve_sensors();
+	t_fans *fans = retrieve_fans();
+
+	snprintf(path, sizeof(path), "/tmp/mbpfan-history-%d", (int) getpid());
+
+	// Small files, so that recording rotates them
+	mu_assert("Could not start the history", history_init(path, 8 * HISTORY_BLOCK_SIZE, 8, sensors, fans) == 0);
+
+	for (row = 0; row < HISTORY_TEST_ROWS / 2; row++) {
+		fill_history_row(sensors, fans, row);
+		mu_assert("Could not record a row", history_record(sensors, fans) == 0);
+	}
+
+	// Restarting appends to the same file
+	history_exit();
+	mu_assert("Could not restart the history", history_init(path, 8 * HISTORY_BLOCK_SIZE, 8, sensors, fans) == 0);
+
+	for (; row < HISTORY_TEST_ROWS; row++) {
+		fill_history_row(sensors, fans, row);
+		mu_assert("Could not record a row", history_record(sensors, fans) == 0);
+	}
+
+	history_exit();
+
+	long long size = 0;
+
+	for (i = 1; i <= 8; i++) {
+		snprintf(rotated, sizeof(rotated), "%s.%d", path, i);
+
+		if (stat(rotated, &info) == 0) {
+			size += info.st_size;
+		}
+	}
+
+	mu_assert("History was not rotated", size > 0);
+	mu_assert("Could not stat the history", stat(path, &info) == 0);
+	size += info.st_size;
+	printf("Recorded %d rows of %u columns in %lld bytes, %.1f bits per value\n", HISTORY_TEST_ROWS, sensors->count + fans->count, size,
+		size * 8.0 / HISTORY_TEST_ROWS / (sensors->count + fans->count));
+
+	memset(&check, 0, sizeof(check));
+	mu_assert("Could not query the history", history_query(path, LLONG_MIN, LLONG_MAX, check_history_row, &check) == 0);
+	mu_assert("Rows were lost", check.rows == HISTORY_TEST_ROWS);
+	mu_assert("Rows were not decoded as recorded", check.mismatches == 0);
+	mu_assert("Rotated files were not read", check.files > 1);
+
+	memset(&check, 0, sizeof(check));
+	mu_assert("Could not query the future", history_query(path, (long long) time(NULL) * 1000 + 60000, LLONG_MAX, check_history_row, &check) == 0);
+	mu_assert("Rows out of range were returned", check.rows == 0);
+
+	mu_assert("Missing history was read", history_query("/nonexistent/history", LLONG_MIN, LLONG_MAX, check_history_row, &check) == -ENOENT);
+
+	unlink(path);
+
+	for (i = 1; i <= 8; i++) {
+		snprintf(rotated, sizeof(rotated), "%s.%d", path, i);
+		unlink(rotated);
+	}
+
+	// A corrupt block ends the query instead of reading past its stream
+	mu_assert("Could not start the history", history_init(path, 8 * HISTORY_BLOCK_SIZE, 8, sensors, fans) == 0);
+
+	for (row = 0; row < 10; row++) {
+		fill_history_row(sensors, fans, row);
+		mu_assert("Could not record a row", history_record(sensors, fans) == 0);
+	}
+
+	history_exit();
+
+	// Right after the first row, every window claims more than 32 bits
+	unsigned char ones[HISTORY_BLOCK_SIZE];
+	size_t first_row = sizeof(t_history_block) + (sensors->count + fans->count) * 4;
+	memset(ones, 0xff, sizeof(ones));
+
+	FILE *file = fopen(path, "r+");
+	mu_assert("Could not open the history", file != NULL);
+	fseek(file, HISTORY_BLOCK_SIZE + (long) first_row, SEEK_SET);
+	fwrite(ones, 1, HISTORY_BLOCK_SIZE - first_row, file);
+	fclose(file);
+
+	memset(&check, 0, sizeof(check));
+	mu_assert("Could not query a corrupt history", history_query(path, LLONG_MIN, LLONG_MAX, check_history_row, &check) == 0);
+	mu_assert("Corrupt rows were returned", check.rows <= 1);
+
+	// Counts that only fit the columns once their sum wraps around
+	uint32_t counts[2] = { 0xffffffff, 1 };
+	file = fopen(path, "r+");
+	mu_assert("Could not open the history", file != NULL);
+	fseek(file, (long) offsetof(t_history_header, sensor_count), SEEK_SET);
+	fwrite(counts, sizeof(counts), 1, file);
+	fclose(file);
+	mu_assert("Corrupt header was read", history_query(path, LLONG_MIN, LLONG_MAX, check_history_row, &check) == -EPROTO);
+
+	unlink(path);
+
+	// mbpfan --history reads the file the daemon records into
+	char setting[PATH_MAX];
+	snprintf(rotated, sizeof(rotated), "%s.conf", path);
+	file = fopen(rotated, "w");
+	mu_assert("Could not write the settings", file != NULL);
+	fprintf(file, "[general]\nhistory_file = %s # recorded here\n", path);
+	fclose(file);
+
+	mu_assert("history_file was not read", retrieve_history_file(rotated, setting, sizeof(setting)) && strcmp(setting, path) == 0);
+	mu_assert("Unset history_file was read", !retrieve_history_file("./mbpfan.conf", setting, sizeof(setting)));
+	unlink(rotated);
+
+	free_fans(fans);
+	free_sensors(sensors);
+	remove_fake_applesmc();
+	return 0;
+}
 
 static const char *all_tests() {
 	mu_run_test(test_sensor_paths);
 	mu_run_test(test_fan_paths);
+	mu_run_test(test_fan_discovery);
 	mu_run_test(test_get_temp);
 	mu_run_test(test_config_file);
 	mu_run_test(test_settings);
 	mu_run_test(test_sighup_receive);
 	mu_run_test(test_settings_reload);
+	mu_run_test(test_sysfs_parse);
+	mu_run_test(test_sysfs_parse_benchmark);
+	mu_run_test(test_uring_refresh);
+	mu_run_test(test_pool_benchmark);
+	mu_run_test(test_aggregate);
+	mu_run_test(test_fan_curve);
+	mu_run_test(test_fan_write_suppression);
+	mu_run_test(test_fan_limits);
+	mu_run_test(test_tach_feedback);
+	mu_run_test(test_pid);
+	mu_run_test(test_scheduler);
+	mu_run_test(test_adaptive_polling);
+	mu_run_test(test_curve_table);
+	mu_run_test(test_curve_points);
+	mu_run_test(test_estimator);
+	mu_run_test(test_zones);
+	mu_run_test(test_autotune);
+	mu_run_test(test_loop);
+	mu_run_test(test_settings_rejected);
+	mu_run_test(test_config_watch);
+	mu_run_test(test_control);
+	mu_run_test(test_telemetry);
+	mu_run_test(test_metrics);
+	mu_run_test(test_history);
 	return 0;
 }
 
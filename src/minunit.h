@@ -14,12 +14,37 @@ extern int tests_run;
 
 static const char *test_sensor_paths();
 static const char *test_fan_paths();
+static const char *test_fan_discovery();
 static const char *test_get_temp();
 static const char *test_config_file();
 static const char *test_settings();
 static void handler(int signal);
 static const char *test_sighup_receive();
 static const char *test_settings_reload();
+static const char *test_sysfs_parse();
+static const char *test_sysfs_parse_benchmark();
+static const char *test_uring_refresh();
+static const char *test_pool_benchmark();
+static const char *test_aggregate();
+static const char *test_fan_curve();
+static const char *test_fan_write_suppression();
+static const char *test_fan_limits();
+static const char *test_tach_feedback();
+static const char *test_pid();
+static const char *test_scheduler();
+static const char *test_adaptive_polling();
+static const char *test_curve_table();
+static const char *test_curve_points();
+static const char *test_estimator();
+static const char *test_zones();
+static const char *test_autotune();
+static const char *test_loop();
+static const char *test_settings_rejected();
+static const char *test_config_watch();
+static const char *test_control();
+static const char *test_telemetry();
+static const char *test_metrics();
+static const char *test_history();
 static const char *all_tests();
 
 int tests();
@@ -0,0 +1,86 @@
+/* pid.c - PID fan controller
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Runs on millidegrees and milliseconds with 64 bit integers, so the
+ * control loop stays free of floating point. The derivative acts on the
+ * measurement rather than on the error, so a setpoint change does not
+ * kick the fans, and is low-pass filtered against sensor noise. The
+ * integral stops growing while the output is saturated (anti-windup).
+ */
+
+#include "pid.h"
+
+void pid_configure(t_pid *pid, int setpoint, double kp, double ki, double kd, double filter, int out_min, int out_max) {
+	pid->setpoint  = setpoint;
+	pid->kp        = (long long)(kp * 1000.0);
+	pid->ki        = (long long)(ki * 1000.0);
+	pid->kd        = (long long)(kd * 1000.0);
+	pid->filter_ms = (int)(filter * 1000.0);
+	pid->out_min   = out_min;
+	pid->out_max   = out_max;
+}
+
+void pid_reset(t_pid *pid) {
+	pid->integral   = 0;
+	pid->derivative = 0;
+	pid->previous   = 0;
+	pid->primed     = 0;
+}
+
+int pid_update(t_pid *pid, int temp, int dt_ms) {
+	long long error = (long long) temp - pid->setpoint;
+
+	if (dt_ms <= 0) {
+		dt_ms = 1;
+	}
+
+	if (pid->primed) {
+		long long rate = ((long long) temp - pid->previous) * 1000 / dt_ms;
+
+		// First order low-pass: alpha = dt / (filter + dt)
+		pid->derivative += (rate - pid->derivative) * dt_ms / (pid->filter_ms + dt_ms);
+	}
+
+	pid->previous = temp;
+	pid->primed   = 1;
+
+	long long integral = pid->integral + error * dt_ms;
+
+	// Gains are in thousandths, errors in millidegrees
+	long long proportional = pid->kp * error / 1000000;
+	long long derivative   = pid->kd * pid->derivative / 1000000;
+	long long output       = pid->out_min + proportional + pid->ki * integral / 1000000000 + derivative;
+
+	// Only integrate while it does not push the output further into saturation
+	if ((output > pid->out_max && error > 0) || (output < pid->out_min && error < 0)) {
+		output = pid->out_min + proportional + pid->ki * pid->integral / 1000000000 + derivative;
+	}
+	else {
+		pid->integral = integral;
+	}
+
+	// Nor beyond what the whole output range can use
+	if (pid->ki > 0) {
+		long long limit = (long long)(pid->out_max - pid->out_min) * 1000000000 / pid->ki;
+
+		if (pid->integral > limit) {
+			pid->integral = limit;
+		}
+
+		if (pid->integral < -limit) {
+			pid->integral = -limit;
+		}
+	}
+
+	if (output > pid->out_max) {
+		output = pid->out_max;
+	}
+
+	if (output < pid->out_min) {
+		output = pid->out_min;
+	}
+
+	return (int) output;
+}
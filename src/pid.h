@@ -0,0 +1,61 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _PID_H_
+#define _PID_H_
+
+/** PID controller in integer fixed point
+ *  setpoint   - temperature to hold, in millidegrees
+ *  kp, ki, kd - gains in thousandths of RPM per degree, of RPM per
+ *               degree-second and of RPM-seconds per degree
+ *  filter_ms  - time constant of the derivative low-pass filter
+ *  out_min, out_max - output clamp, in RPM
+ */
+struct s_pid {
+	int setpoint;
+	long long kp;
+	long long ki;
+	long long kd;
+	int filter_ms;
+	int out_min;
+	int out_max;
+
+	long long integral;    // error integrated over time, millidegree-milliseconds
+	long long derivative;  // filtered rate of change, millidegrees per second
+	int previous;          // last measurement, millidegrees
+	int primed;            // FALSE until the first update
+};
+
+typedef struct s_pid t_pid;
+
+/**
+ * Set the tuning of a controller, gains in RPM per degree, RPM per
+ * degree-second and RPM-seconds per degree, filter in seconds
+ * Keeps the integral, so a reload does not make the fans jump
+ */
+void pid_configure(t_pid *pid, int setpoint, double kp, double ki, double kd, double filter, int out_min, int out_max);
+
+/**
+ * Forget the integral and the derivative history
+ */
+void pid_reset(t_pid *pid);
+
+/**
+ * Feed a temperature measured dt_ms after the previous one
+ * Return the fan speed, within out_min and out_max
+ */
+int pid_update(t_pid *pid, int temp, int dt_ms);
+
+#endif
@@ -0,0 +1,157 @@
+/* pool.c - read slow sensors concurrently
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Every applesmc read blocks on an SMC transaction, so reading the
+ * sensors one after the other makes a tick as long as the sum of all
+ * reads. The workers here split a batch between them, which bounds a
+ * tick by the slowest reads instead.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "pool.h"
+
+struct s_pool {
+	pthread_t threads[POOL_WORKERS_MAX];
+	unsigned int workers;
+	t_sensors *sensors;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  start;
+	pthread_cond_t  done;
+
+	unsigned long generation;  // bumped for every batch
+	unsigned long spawned;     // generation when the workers were started
+	unsigned int next;         // next sensor to read in the batch
+	unsigned int remaining;    // sensors of the batch not read yet
+	int in_flight;
+	int stopping;
+};
+
+static struct s_pool pool = {
+	.lock  = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done  = PTHREAD_COND_INITIALIZER,
+};
+
+static void *pool_worker(void *arg) {
+	(void) arg;
+
+	pthread_mutex_lock(&pool.lock);
+
+	unsigned long seen = pool.spawned;
+
+	while (1) {
+		while (!pool.stopping && pool.generation == seen) {
+			pthread_cond_wait(&pool.start, &pool.lock);
+		}
+
+		if (pool.stopping) {
+			break;
+		}
+
+		seen = pool.generation;
+
+		while (pool.next < pool.sensors->count) {
+			t_sensors *sensors = pool.sensors;
+			unsigned int i = pool.next++;
+
+			pthread_mutex_unlock(&pool.lock);
+
+			int result = sensor_read(sensors->fd[i], &sensors->temperature[i]);
+
+			if (result != 0) {
+				sensor_read_failed(sensors, i, result);
+			}
+
+			pthread_mutex_lock(&pool.lock);
+
+			if (--pool.remaining == 0) {
+				pool.in_flight = 0;
+				pthread_cond_broadcast(&pool.done);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+int pool_init(t_sensors *sensors, unsigned int workers) {
+	pool_exit();
+
+	if (workers > POOL_WORKERS_MAX) {
+		workers = POOL_WORKERS_MAX;
+	}
+
+	pool.sensors   = sensors;
+	pool.spawned   = pool.generation;
+	pool.stopping  = 0;
+	pool.in_flight = 0;
+
+	for (pool.workers = 0; pool.workers < workers; pool.workers++) {
+		int result = pthread_create(&pool.threads[pool.workers], NULL, pool_worker, NULL);
+
+		if (result != 0) {
+			pool_exit();
+			return -result;
+		}
+	}
+
+	return 0;
+}
+
+int pool_active() {
+	return pool.workers > 0;
+}
+
+void pool_start() {
+	pthread_mutex_lock(&pool.lock);
+
+	if (!pool.in_flight && pool.sensors->count > 0) {
+		pool.next      = 0;
+		pool.remaining = pool.sensors->count;
+		pool.in_flight = 1;
+		pool.generation++;
+		pthread_cond_broadcast(&pool.start);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void pool_wait() {
+	pthread_mutex_lock(&pool.lock);
+
+	while (pool.in_flight) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void pool_exit() {
+	unsigned int i;
+
+	if (pool.workers == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stopping = 1;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.workers; i++) {
+		pthread_join(pool.threads[i], NULL);
+	}
+
+	pool.workers   = 0;
+	pool.in_flight = 0;
+	pool.stopping  = 0;
+}
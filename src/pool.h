@@ -0,0 +1,54 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/** Upper bound for the sensor_workers setting
+*/
+#define POOL_WORKERS_MAX 16
+
+struct s_sensors;
+typedef struct s_sensors t_sensors;
+
+/**
+ * Start worker threads that read the sensors of a table concurrently
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int pool_init(t_sensors *sensors, unsigned int workers);
+
+/**
+ * Return TRUE if pool_init() succeeded
+ */
+int pool_active();
+
+/**
+ * Start reading every sensor of the table in the background,
+ * unless a batch is already in flight
+ */
+void pool_start();
+
+/**
+ * Wait until the batch in flight, if any, has been read
+ */
+void pool_wait();
+
+/**
+ * Stop and join the workers
+ */
+void pool_exit();
+
+#endif
@@ -0,0 +1,70 @@
+/* scheduler.c - drift free control loop timing
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include "scheduler.h"
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_S  1000000000LL
+
+long long monotonic_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * NS_PER_S + now.tv_nsec;
+}
+
+static void sleep_until(long long deadline) {
+	struct timespec until = { .tv_sec = deadline / NS_PER_S, .tv_nsec = deadline % NS_PER_S };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+void scheduler_init(t_scheduler *scheduler, int interval_ms) {
+	scheduler->last_tick   = monotonic_ns();
+	scheduler->interval_ms = interval_ms;
+	scheduler->deadline    = scheduler->last_tick + interval_ms * NS_PER_MS;
+	scheduler->ticks       = 0;
+	scheduler->missed      = 0;
+	scheduler->late_ms     = 0;
+}
+
+void scheduler_set_interval(t_scheduler *scheduler, int interval_ms) {
+	scheduler->interval_ms = interval_ms;
+	scheduler->deadline    = scheduler->last_tick + interval_ms * NS_PER_MS;
+}
+
+int scheduler_wait(t_scheduler *scheduler) {
+	sleep_until(scheduler->deadline);
+
+	return scheduler_tick(scheduler);
+}
+
+int scheduler_tick(t_scheduler *scheduler) {
+	long long interval = scheduler->interval_ms * NS_PER_MS;
+	long long now      = monotonic_ns();
+	long long late = now - scheduler->deadline;
+
+	// The previous tick overran one or more deadlines: skip them instead of bursting
+	if (late >= interval) {
+		long long skipped = late / interval;
+
+		scheduler->missed   += (unsigned long) skipped;
+		scheduler->deadline += skipped * interval;
+
+		printf("Missed %lld polling deadlines (%lu in total)\n", skipped, scheduler->missed);
+	}
+
+	int elapsed_ms = (int)((now - scheduler->last_tick + NS_PER_MS / 2) / NS_PER_MS);
+
+	scheduler->late_ms    = (int)((now - scheduler->deadline) / NS_PER_MS);
+	scheduler->last_tick  = now;
+	scheduler->deadline  += interval;
+	scheduler->ticks++;
+
+	return elapsed_ms;
+}
@@ -0,0 +1,61 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+/** Ticks on absolute CLOCK_MONOTONIC deadlines, so the period does not
+ *  drift by the time spent sampling and writing
+ */
+struct s_scheduler {
+	long long deadline;   // next tick, nanoseconds
+	long long last_tick;  // start of the previous tick, nanoseconds
+	int interval_ms;
+
+	unsigned long ticks;
+	unsigned long missed; // deadlines skipped because a tick overran
+	int late_ms;          // how late the last tick started
+};
+
+typedef struct s_scheduler t_scheduler;
+
+/**
+ * Return CLOCK_MONOTONIC in nanoseconds
+ */
+long long monotonic_ns();
+
+/**
+ * Start ticking every interval_ms, the first tick is due one interval from now
+ */
+void scheduler_init(t_scheduler *scheduler, int interval_ms);
+
+/**
+ * Change the interval, the next tick is due one new interval after the previous one
+ */
+void scheduler_set_interval(t_scheduler *scheduler, int interval_ms);
+
+/**
+ * Sleep until the next tick is due and start it
+ * Return the milliseconds elapsed since the previous tick started
+ */
+int scheduler_wait(t_scheduler *scheduler);
+
+/**
+ * Start the tick that is due, for callers that wait on their own
+ * Return the milliseconds elapsed since the previous tick started
+ */
+int scheduler_tick(t_scheduler *scheduler);
+
+#endif
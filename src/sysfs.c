@@ -0,0 +1,101 @@
+/* sysfs.c - read and write integer sysfs attributes
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * The sensor loop reads every temperature attribute on every tick, so
+ * these avoid stdio, scanf and the heap entirely.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "sysfs.h"
+
+int sysfs_parse_int(const char *buf, size_t len, int *out) {
+	size_t i = 0;
+	int negative = 0;
+
+	// The kernel terminates attributes with a newline
+	if (len > 0 && buf[len - 1] == '\n') {
+		len--;
+	}
+
+	if (len > 0 && (buf[0] == '-' || buf[0] == '+')) {
+		negative = buf[0] == '-';
+		i++;
+	}
+
+	if (i == len) {
+		return -EINVAL;
+	}
+
+	// Accumulate as a negative number so INT_MIN is representable
+	int value = 0;
+
+	for (; i < len; i++) {
+		unsigned int digit = (unsigned int)(buf[i] - '0');
+
+		if (digit > 9) {
+			return -EINVAL;
+		}
+
+		if (value < (INT_MIN + (int) digit) / 10) {
+			return -ERANGE;
+		}
+
+		value = value * 10 - (int) digit;
+	}
+
+	if (!negative) {
+		if (value == INT_MIN) {
+			return -ERANGE;
+		}
+
+		value = -value;
+	}
+
+	*out = value;
+	return 0;
+}
+
+int sysfs_read_int(int fd, int *out) {
+	char buf[SYSFS_INT_LEN];
+	ssize_t len = pread(fd, buf, sizeof(buf), /*offset=*/ 0);
+
+	if (len < 0) {
+		return -errno;
+	}
+
+	// A full buffer means the attribute is not a single integer
+	if ((size_t) len == sizeof(buf)) {
+		return -ERANGE;
+	}
+
+	return sysfs_parse_int(buf, (size_t) len, out);
+}
+
+int sysfs_write_int(int fd, int value) {
+	char buf[SYSFS_INT_LEN];
+	char *end = buf + sizeof(buf);
+	char *p = end;
+
+	unsigned int magnitude = value < 0 ? 0U - (unsigned int) value : (unsigned int) value;
+
+	do {
+		*--p = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude != 0);
+
+	if (value < 0) {
+		*--p = '-';
+	}
+
+	ssize_t len = pwrite(fd, p, (size_t)(end - p), /*offset=*/ 0);
+
+	if (len < 0) {
+		return -errno;
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _SYSFS_H_
+#define _SYSFS_H_
+
+#include <stddef.h>
+
+/** Largest integer attribute we read or write, sign and newline included
+*/
+#define SYSFS_INT_LEN 16
+
+/**
+ * Parse a sysfs integer attribute of len bytes:
+ * optional sign, decimal digits, optional trailing newline
+ * Return 0 on success, storing the value in out
+ * Return -EINVAL on malformed input, -ERANGE on overflow
+ */
+int sysfs_parse_int(const char *buf, size_t len, int *out);
+
+/**
+ * Read an integer attribute from offset 0 of an open sysfs file
+ * Return 0 on success, storing the value in out
+ * Return a negative errno otherwise, out is left untouched
+ */
+int sysfs_read_int(int fd, int *out);
+
+/**
+ * Write an integer attribute at offset 0 of an open sysfs file
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int sysfs_write_int(int fd, int value);
+
+#endif
@@ -0,0 +1,213 @@
+/* telemetry.c - every tick in shared memory
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Monitoring tools map the segment instead of reading the SMC again.
+ * It is guarded by a sequence lock: the single writer never waits for
+ * readers, and any number of readers take consistent snapshots with
+ * plain loads, retrying the rare copy that overlapped a tick.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "scheduler.h"
+#include "telemetry.h"
+
+#define NS_PER_S 1000000000LL
+
+static t_telemetry *segment = NULL;
+static char segment_path[PATH_MAX];
+
+int telemetry_init(const char *path, const t_sensors *sensors, const t_fans *fans) {
+	unsigned int i;
+
+	if (strlen(path) >= sizeof(segment_path)) {
+		return -ENAMETOOLONG;
+	}
+
+	// Never reuse what is there, it may be a link or a file somebody else still maps
+	if (unlink(path) != 0 && errno != ENOENT) {
+		return -errno;
+	}
+
+	int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+
+	if (fd == -1) {
+		return -errno;
+	}
+
+	if (ftruncate(fd, sizeof(t_telemetry)) != 0) {
+		int result = -errno;
+		close(fd);
+		return result;
+	}
+
+	void *mapping = mmap(NULL, sizeof(t_telemetry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int result = -errno;
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		return result;
+	}
+
+	segment = mapping;
+	snprintf(segment_path, sizeof(segment_path), "%s", path);
+
+	// A new file reads as zeroes, readers refuse it until the magic is set
+	segment->size         = sizeof(t_telemetry);
+	segment->sensor_count = sensors->count;
+	segment->fan_count    = fans->count;
+
+	for (i = 0; i < sensors->count; i++) {
+		memcpy(segment->sensor_label[i], sensors->label[i], LABEL_LEN);
+		segment->sensor_index[i] = sensors->index[i];
+	}
+
+	for (i = 0; i < fans->count; i++) {
+		memcpy(segment->fan_label[i], fans->label[i], LABEL_LEN);
+		segment->fan_index[i] = fans->index[i];
+	}
+
+	segment->version = TELEMETRY_VERSION;
+
+	__atomic_store_n(&segment->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int telemetry_active() {
+	return segment != NULL;
+}
+
+void telemetry_publish(const t_sensors *sensors, const t_fans *fans, const t_scheduler *scheduler, int elapsed_ms, int temp, int control_temp, int speed) {
+	struct timespec monotonic;
+	struct timespec realtime;
+	unsigned int i;
+
+	if (segment == NULL) {
+		return;
+	}
+
+	// Served from the vDSO, not system calls
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+	clock_gettime(CLOCK_REALTIME, &realtime);
+
+	uint32_t sequence = segment->sequence;
+
+	// Odd before any field changes
+	__atomic_store_n(&segment->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	segment->ticks        = scheduler->ticks;
+	segment->missed       = scheduler->missed;
+	segment->monotonic_ns = monotonic.tv_sec * NS_PER_S + monotonic.tv_nsec;
+	segment->realtime_ns  = realtime.tv_sec * NS_PER_S + realtime.tv_nsec;
+	segment->elapsed_ms   = elapsed_ms;
+	segment->late_ms      = scheduler->late_ms;
+	segment->sample_us    = (int32_t)(sensors->sample_ns / 1000);
+	segment->temp         = temp;
+	segment->control_temp = control_temp;
+	segment->speed        = speed;
+
+	for (i = 0; i < segment->sensor_count; i++) {
+		segment->sensor_temp[i]   = sensors->temperature[i];
+		segment->sensor_errors[i] = sensors->read_errors[i];
+	}
+
+	for (i = 0; i < segment->fan_count; i++) {
+		segment->fan_speed[i]    = fans->last_written[i];
+		segment->fan_measured[i] = fans->measured[i];
+	}
+
+	// Even again after every field changed
+	__atomic_store_n(&segment->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void telemetry_exit() {
+	if (segment == NULL) {
+		return;
+	}
+
+	munmap(segment, sizeof(t_telemetry));
+	unlink(segment_path);
+	segment = NULL;
+}
+
+int telemetry_attach(const char *path, const t_telemetry **mapped) {
+	struct stat info;
+
+	int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+	if (fd == -1) {
+		return -errno;
+	}
+
+	if (fstat(fd, &info) != 0) {
+		int result = -errno;
+		close(fd);
+		return result;
+	}
+
+	// Anybody may create files in /dev/shm, only trust the one the daemon made
+	if (!S_ISREG(info.st_mode) || info.st_uid != 0) {
+		close(fd);
+		return -EPERM;
+	}
+
+	if ((size_t) info.st_size < sizeof(t_telemetry)) {
+		close(fd);
+		return -EPROTO;
+	}
+
+	void *mapping = mmap(NULL, sizeof(t_telemetry), PROT_READ, MAP_SHARED, fd, 0);
+	int result = -errno;
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		return result;
+	}
+
+	const t_telemetry *candidate = mapping;
+
+	if (__atomic_load_n(&candidate->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC || candidate->version != TELEMETRY_VERSION) {
+		munmap(mapping, sizeof(t_telemetry));
+		return -EPROTO;
+	}
+
+	*mapped = candidate;
+	return 0;
+}
+
+int telemetry_read(const t_telemetry *mapped, t_telemetry *snapshot) {
+	unsigned int attempt;
+
+	for (attempt = 0; attempt < TELEMETRY_READ_ATTEMPTS; attempt++) {
+		uint32_t before = __atomic_load_n(&mapped->sequence, __ATOMIC_ACQUIRE);
+
+		// A tick is being written
+		if (before & 1) {
+			continue;
+		}
+
+		memcpy(snapshot, (const void *) mapped, sizeof(*snapshot));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&mapped->sequence, __ATOMIC_RELAXED) == before) {
+			return 0;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+void telemetry_detach(const t_telemetry *mapped) {
+	munmap((void *) mapped, sizeof(t_telemetry));
+}
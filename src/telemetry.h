@@ -0,0 +1,117 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+#include "global.h"
+
+/** Where the daemon publishes every tick
+ */
+#define TELEMETRY_PATH "/dev/shm/mbpfan"
+
+#define TELEMETRY_MAGIC   0x4d425046  // "MBPF"
+#define TELEMETRY_VERSION 1
+
+/** Times a reader retries a snapshot torn by the writer before giving up
+ */
+#define TELEMETRY_READ_ATTEMPTS 1000
+
+struct s_scheduler;
+typedef struct s_scheduler t_scheduler;
+
+/** The shared segment, rewritten in place on every tick
+ *  sequence is odd while a tick is being written, readers copy the
+ *  segment and keep the copy only if sequence did not change meanwhile
+ *  Labels and counts are written once, before magic
+ */
+struct s_telemetry {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;      // sizeof(t_telemetry) of the writer
+	uint32_t sequence;
+
+	uint32_t sensor_count;
+	uint32_t fan_count;
+	char     sensor_label[SENSORS_MAX][LABEL_LEN];  // empty for tempN_input without a label
+	char     fan_label[FANS_MAX][LABEL_LEN];
+	uint32_t sensor_index[SENSORS_MAX];             // N in tempN_input
+	uint32_t fan_index[FANS_MAX];                   // N in fanN_output
+
+	uint64_t ticks;
+	uint64_t missed;        // deadlines skipped so far
+	int64_t  monotonic_ns;  // CLOCK_MONOTONIC when the tick was published
+	int64_t  realtime_ns;   // CLOCK_REALTIME of the same moment
+	int32_t  elapsed_ms;    // since the previous tick
+	int32_t  late_ms;       // past the deadline of the tick
+	int32_t  sample_us;     // spent reading the sensors
+
+	int32_t  temp;          // aggregated, millidegrees
+	int32_t  control_temp;  // the fans were set for, predicted when the estimator is on
+	int32_t  speed;         // chosen by the controller, or held by an override
+
+	int32_t  sensor_temp[SENSORS_MAX];    // millidegrees
+	uint32_t sensor_errors[SENSORS_MAX];  // failed reads
+	int32_t  fan_speed[FANS_MAX];         // last written, -1 if unknown
+	int32_t  fan_measured[FANS_MAX];      // read back, 0 without tach_feedback
+};
+
+typedef struct s_telemetry t_telemetry;
+
+/**
+ * Create the segment at path for a table of sensors and fans, replacing
+ * whatever is there
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int telemetry_init(const char *path, const t_sensors *sensors, const t_fans *fans);
+
+/**
+ * Return TRUE if telemetry_init() succeeded
+ */
+int telemetry_active();
+
+/**
+ * Publish a tick, without any system call
+ */
+void telemetry_publish(const t_sensors *sensors, const t_fans *fans, const t_scheduler *scheduler, int elapsed_ms, int temp, int control_temp, int speed);
+
+/**
+ * Unmap and remove the segment, if any
+ */
+void telemetry_exit();
+
+/**
+ * Map the segment at path read only, for readers
+ * Return 0 on success
+ * Return a negative errno otherwise, -EPERM unless root owns the file,
+ * -EPROTO for an unknown layout
+ */
+int telemetry_attach(const char *path, const t_telemetry **segment);
+
+/**
+ * Copy a consistent snapshot of a mapped segment, without any system call
+ * Return 0 on success
+ * Return -EAGAIN if every attempt raced with the writer
+ */
+int telemetry_read(const t_telemetry *segment, t_telemetry *snapshot);
+
+/**
+ * Unmap a segment mapped by telemetry_attach()
+ */
+void telemetry_detach(const t_telemetry *segment);
+
+#endif
@@ -0,0 +1,278 @@
+/* uring.c - batched sensor sampling through io_uring
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Every applesmc read is an SMC transaction. Instead of one pread per
+ * sensor, all reads of a tick are queued as READ_FIXED requests against
+ * registered files and a registered buffer, and submitted and reaped
+ * with a single io_uring_enter().
+ *
+ * Talks to the kernel directly, no liburing needed. When the kernel or
+ * the headers lack io_uring, uring_init() fails and the caller falls
+ * back to pread.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "sysfs.h"
+#include "uring.h"
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+struct s_ring {
+	int fd;
+
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	struct io_uring_cqe *cqes;
+
+	char buffers[SENSORS_MAX][SYSFS_INT_LEN];
+};
+
+static struct s_ring ring = { .fd = -1 };
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *params) {
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args) {
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(t_sensors *sensors) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	uring_exit();
+
+	ring.fd = sys_io_uring_setup(sensors->count, &params);
+
+	if (ring.fd < 0) {
+		ring.fd = -1;
+		return -errno;
+	}
+
+	ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_size > ring.sq_size) {
+			ring.sq_size = ring.cq_size;
+		}
+
+		ring.cq_size = ring.sq_size;
+	}
+
+	ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+
+	if (ring.sq_ptr == MAP_FAILED) {
+		ring.sq_ptr = NULL;
+		goto fail;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring.cq_ptr = ring.sq_ptr;
+	}
+	else {
+		ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+
+		if (ring.cq_ptr == MAP_FAILED) {
+			ring.cq_ptr = NULL;
+			goto fail;
+		}
+	}
+
+	ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+
+	if (ring.sqes == MAP_FAILED) {
+		ring.sqes = NULL;
+		goto fail;
+	}
+
+	ring.sq_head  = (unsigned int *)((char *) ring.sq_ptr + params.sq_off.head);
+	ring.sq_tail  = (unsigned int *)((char *) ring.sq_ptr + params.sq_off.tail);
+	ring.sq_mask  = (unsigned int *)((char *) ring.sq_ptr + params.sq_off.ring_mask);
+	ring.sq_array = (unsigned int *)((char *) ring.sq_ptr + params.sq_off.array);
+	ring.cq_head  = (unsigned int *)((char *) ring.cq_ptr + params.cq_off.head);
+	ring.cq_tail  = (unsigned int *)((char *) ring.cq_ptr + params.cq_off.tail);
+	ring.cq_mask  = (unsigned int *)((char *) ring.cq_ptr + params.cq_off.ring_mask);
+	ring.cqes     = (struct io_uring_cqe *)((char *) ring.cq_ptr + params.cq_off.cqes);
+
+	if (sys_io_uring_register(ring.fd, IORING_REGISTER_FILES, sensors->fd, sensors->count) < 0) {
+		goto fail;
+	}
+
+	struct iovec iov = { .iov_base = ring.buffers, .iov_len = sizeof(ring.buffers) };
+
+	if (sys_io_uring_register(ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:;
+	int error = errno;
+	uring_exit();
+	return -error;
+}
+
+int uring_active() {
+	return ring.fd != -1;
+}
+
+unsigned int uring_refresh(t_sensors *sensors) {
+	unsigned int tail = *ring.sq_tail;
+	unsigned int mask = *ring.sq_mask;
+	unsigned int i;
+
+	for (i = 0; i < sensors->count; i++) {
+		unsigned int slot = tail & mask;
+		struct io_uring_sqe *sqe = &ring.sqes[slot];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode    = IORING_OP_READ_FIXED;
+		sqe->flags     = IOSQE_FIXED_FILE;
+		sqe->fd        = (int) i;
+		sqe->addr      = (unsigned long) ring.buffers[i];
+		sqe->len       = SYSFS_INT_LEN;
+		sqe->off       = 0;
+		sqe->buf_index = 0;
+		sqe->user_data = i;
+
+		ring.sq_array[slot] = slot;
+		tail++;
+	}
+
+	__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+	unsigned int syscalls  = 0;
+	unsigned int pending   = sensors->count;
+	unsigned int to_submit = sensors->count;
+
+	// Normally one call submits and reaps the whole batch
+	while (pending > 0) {
+		int submitted = sys_io_uring_enter(ring.fd, to_submit, pending, IORING_ENTER_GETEVENTS);
+		syscalls++;
+
+		if (submitted < 0) {
+			int error = errno;
+
+			if (error == EINTR) {
+				continue;
+			}
+
+			// The ring is in an unknown state, fall back to pread from now on
+			printf("ERROR: io_uring sampling failed, falling back to pread: %s\n", strerror(error));
+			uring_exit();
+
+			for (i = 0; i < sensors->count; i++) {
+				sensor_read_failed(sensors, i, -error);
+			}
+
+			return syscalls;
+		}
+
+		to_submit -= (unsigned int) submitted;
+
+		unsigned int head = *ring.cq_head;
+
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+			unsigned int index = (unsigned int) cqe->user_data;
+			int result = cqe->res;
+
+			if (result >= 0) {
+				result = result == SYSFS_INT_LEN ? -ERANGE : sysfs_parse_int(ring.buffers[index], (size_t) result, &sensors->temperature[index]);
+			}
+
+			if (result != 0) {
+				sensor_read_failed(sensors, index, result);
+			}
+
+			head++;
+			pending--;
+		}
+
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return syscalls;
+}
+
+void uring_exit() {
+	if (ring.sqes != NULL) {
+		munmap(ring.sqes, ring.sqes_size);
+	}
+
+	if (ring.cq_ptr != NULL && ring.cq_ptr != ring.sq_ptr) {
+		munmap(ring.cq_ptr, ring.cq_size);
+	}
+
+	if (ring.sq_ptr != NULL) {
+		munmap(ring.sq_ptr, ring.sq_size);
+	}
+
+	if (ring.fd != -1) {
+		close(ring.fd);
+	}
+
+	ring.sqes   = NULL;
+	ring.cq_ptr = NULL;
+	ring.sq_ptr = NULL;
+	ring.fd     = -1;
+}
+
+#else
+
+int uring_init(t_sensors *sensors) {
+	(void) sensors;
+	return -ENOSYS;
+}
+
+int uring_active() {
+	return 0;
+}
+
+unsigned int uring_refresh(t_sensors *sensors) {
+	(void) sensors;
+	return 0;
+}
+
+void uring_exit() {
+}
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+struct s_sensors;
+typedef struct s_sensors t_sensors;
+
+/**
+ * Set up an io_uring for a table of sensors, registering
+ * their files and one fixed buffer for all their samples
+ * Return 0 on success
+ * Return a negative errno if io_uring is unavailable
+ */
+int uring_init(t_sensors *sensors);
+
+/**
+ * Return TRUE if uring_init() succeeded
+ */
+int uring_active();
+
+/**
+ * Read every sensor of the table with a single submission
+ * Failed reads are handed to sensor_read_failed()
+ * Return the number of system calls made
+ */
+unsigned int uring_refresh(t_sensors *sensors);
+
+/**
+ * Tear down the ring, if any
+ */
+void uring_exit();
+
+#endif
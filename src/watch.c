@@ -0,0 +1,163 @@
+/* watch.c - follow changes of the settings file
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * The directory is watched as well as the file, since editors and
+ * configuration tools usually write a new file and rename it over the
+ * old one, which ends the watch of the file itself. Events only arm a
+ * debounce deadline; whether the content really changed is decided by
+ * its hash once the writes have settled.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "scheduler.h"
+#include "watch.h"
+
+#define DIR_EVENTS  (IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE)
+#define FILE_EVENTS (IN_CLOSE_WRITE | IN_MODIFY)
+
+/* FNV-1a of the content of path, 0 when it cannot be read */
+static unsigned long long hash_file(const char *path) {
+	unsigned long long hash = 14695981039346656037ULL;
+	unsigned char buf[4096];
+	ssize_t n;
+	ssize_t i;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1) {
+		return 0;
+	}
+
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			close(fd);
+			return 0;
+		}
+
+		for (i = 0; i < n; i++) {
+			hash = (hash ^ buf[i]) * 1099511628211ULL;
+		}
+	}
+
+	close(fd);
+	return hash;
+}
+
+/* Follow the file itself, through symbolic links, when it exists */
+static void watch_file(t_watch *watch) {
+	watch->file_wd = inotify_add_watch(watch->fd, watch->path, FILE_EVENTS);
+}
+
+int watch_init(t_watch *watch, const char *path) {
+	const char *slash = strrchr(path, '/');
+
+	memset(watch, 0, sizeof(*watch));
+	watch->fd      = -1;
+	watch->dir_wd  = -1;
+	watch->file_wd = -1;
+
+	if (strlen(path) >= sizeof(watch->path)) {
+		return -ENAMETOOLONG;
+	}
+
+	snprintf(watch->path, sizeof(watch->path), "%s", path);
+
+	if (slash == NULL) {
+		snprintf(watch->dir, sizeof(watch->dir), ".");
+		snprintf(watch->name, sizeof(watch->name), "%s", path);
+	}
+	else {
+		snprintf(watch->dir, sizeof(watch->dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+		snprintf(watch->name, sizeof(watch->name), "%s", slash + 1);
+	}
+
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (watch->fd == -1) {
+		return -errno;
+	}
+
+	watch->dir_wd = inotify_add_watch(watch->fd, watch->dir, DIR_EVENTS);
+
+	if (watch->dir_wd == -1) {
+		int result = -errno;
+		watch_exit(watch);
+		return result;
+	}
+
+	watch_file(watch);
+	watch->hash = hash_file(watch->path);
+	return 0;
+}
+
+void watch_read(int fd, void *ctx) {
+	t_watch *watch = ctx;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	int changed = 0;
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + n; p += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *) p;
+
+			if (event->wd == watch->file_wd) {
+				if (event->mask & IN_IGNORED) {
+					watch->file_wd = -1;
+				}
+				else {
+					changed = 1;
+				}
+			}
+			else if (event->wd == watch->dir_wd && event->len > 0 && strcmp(event->name, watch->name) == 0) {
+				changed = 1;
+
+				// A new file took the name: follow it instead of the old one
+				if (event->mask & (IN_MOVED_TO | IN_CREATE)) {
+					watch_file(watch);
+				}
+			}
+		}
+	}
+
+	if (changed) {
+		watch->due_ns = monotonic_ns() + WATCH_DEBOUNCE_MS * 1000000LL;
+	}
+}
+
+int watch_changed(t_watch *watch) {
+	unsigned long long hash = hash_file(watch->path);
+
+	watch->due_ns = 0;
+
+	// Gone or half renamed: the event completing the change comes later
+	if (hash == 0 || hash == watch->hash) {
+		return 0;
+	}
+
+	watch->hash = hash;
+	return 1;
+}
+
+void watch_exit(t_watch *watch) {
+	if (watch->fd != -1) {
+		close(watch->fd);
+	}
+
+	watch->fd      = -1;
+	watch->dir_wd  = -1;
+	watch->file_wd = -1;
+	watch->due_ns  = 0;
+}
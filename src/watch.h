@@ -0,0 +1,69 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include <limits.h>
+
+/** Quiet time after the last change of the settings file before it is
+ *  read, so an editor or a configuration tool writing it in several steps
+ *  causes a single reload
+ */
+#define WATCH_DEBOUNCE_MS 250
+
+/** Watches a file with inotify, both directly and through its directory
+ *  so that it is still followed after being replaced by a rename
+ */
+struct s_watch {
+	int fd;       // inotify instance, -1 when not watching
+	int dir_wd;
+	int file_wd;  // -1 while the file does not exist
+
+	char path[PATH_MAX];
+	char dir[PATH_MAX];
+	char name[NAME_MAX + 1];
+
+	unsigned long long hash;  // of the content last seen, 0 when unreadable
+	long long due_ns;         // CLOCK_MONOTONIC time the changes settle, 0 for none
+};
+
+typedef struct s_watch t_watch;
+
+/**
+ * Start watching the file at path, remembering the hash of its content
+ * Return 0 on success
+ * Return a negative errno otherwise
+ */
+int watch_init(t_watch *watch, const char *path);
+
+/**
+ * Read the pending inotify events of the t_watch in ctx and push due_ns
+ * back when they concern the file, a loop_handler for watch->fd
+ */
+void watch_read(int fd, void *ctx);
+
+/**
+ * Hash the file and remember the result, clearing due_ns
+ * Return TRUE if the content differs from the one last seen
+ */
+int watch_changed(t_watch *watch);
+
+/**
+ * Stop watching and close the inotify instance
+ */
+void watch_exit(t_watch *watch);
+
+#endif
@@ -0,0 +1,179 @@
+/* zone.c - sensor groups driving fan groups
+ *
+ * Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ * Modifications (2018-present) by Kenneth Malinich <kennygprs@gmail.com>
+ *
+ * Each zone aggregates its own sensors and follows its own curve, so a
+ * hot GPU only spins the fans over it and cool sensors elsewhere cannot
+ * average the CPU down. A fan held by several zones runs at the highest
+ * speed any of them asks for.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zone.h"
+
+/* Copy the next comma separated selector, without blanks, into out
+ * Return the rest of the list, NULL when there is none
+ */
+static const char *next_selector(const char *spec, char *out, size_t n_out) {
+	size_t length = 0;
+
+	if (spec == NULL || *spec == '\0') {
+		return NULL;
+	}
+
+	while (*spec == ' ' || *spec == '\t') {
+		spec++;
+	}
+
+	while (*spec != '\0' && *spec != ',') {
+		if (!isspace((unsigned char) *spec) && length + 1 < n_out) {
+			out[length++] = *spec;
+		}
+
+		spec++;
+	}
+
+	out[length] = '\0';
+	return *spec == ',' ? spec + 1 : spec;
+}
+
+/* Whether a selector names a column with this label or index */
+static int selector_matches(const char *selector, const char *label, unsigned int index) {
+	char *end;
+	unsigned long number = strtoul(selector, &end, 10);
+
+	if (end != selector && *end == '\0') {
+		return number == index;
+	}
+
+	return strcmp(selector, label) == 0;
+}
+
+int zone_bind(t_zone *zone, const t_sensors *sensors, const t_fans *fans) {
+	char selector[LABEL_LEN];
+	const char *spec;
+	unsigned int i;
+
+	zone->sensor_count = 0;
+	zone->fan_count    = 0;
+
+	for (spec = zone->sensors_spec; (spec = next_selector(spec, selector, sizeof(selector))) != NULL;) {
+		unsigned int found = 0;
+
+		for (i = 0; i < sensors->count; i++) {
+			if (selector_matches(selector, sensors->label[i], sensors->index[i])) {
+				unsigned int n;
+
+				// A sensor named twice still counts once
+				for (n = 0; n < zone->sensor_count && zone->sensor[n] != i; n++) {
+				}
+
+				if (n == zone->sensor_count) {
+					zone->aggregation.weight[n] = aggregation_weight(&zone->aggregation, sensors->label[i]);
+					zone->sensor[zone->sensor_count++] = i;
+				}
+
+				found++;
+			}
+		}
+
+		if (found == 0 && selector[0] != '\0') {
+			printf("Zone %s: no sensor %s\n", zone->name, selector);
+		}
+	}
+
+	for (spec = zone->fans_spec; (spec = next_selector(spec, selector, sizeof(selector))) != NULL;) {
+		unsigned int found = 0;
+
+		for (i = 0; i < fans->count; i++) {
+			if (selector_matches(selector, fans->label[i], fans->index[i])) {
+				unsigned int n;
+
+				for (n = 0; n < zone->fan_count && zone->fan[n] != i; n++) {
+				}
+
+				if (n == zone->fan_count) {
+					zone->fan[zone->fan_count++] = i;
+				}
+
+				found++;
+			}
+		}
+
+		if (found == 0 && selector[0] != '\0') {
+			printf("Zone %s: no fan %s\n", zone->name, selector);
+		}
+	}
+
+	// Half a zone controls nothing
+	if (zone->sensor_count == 0 || zone->fan_count == 0) {
+		zone->sensor_count = 0;
+		zone->fan_count    = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+void zone_build(t_zone *zone) {
+	if (zone->points.count > 0) {
+		curve_build(&zone->curve, zone->points.temp[0], zone->points.temp[zone->points.count - 1], curve_points_speed, curve_points_speed, &zone->points);
+	}
+	else {
+		curve_build(&zone->curve, zone->triangle.low_temp, zone->triangle.max_temp, curve_triangle_up, curve_triangle_down, &zone->triangle);
+	}
+
+	zone->speed  = zone->triangle.min_speed;
+	zone->primed = 0;
+}
+
+int zone_update(t_zone *zone, const int *samples) {
+	int gathered[SENSORS_MAX];
+	unsigned int i;
+
+	if (zone->sensor_count == 0) {
+		return zone->speed;
+	}
+
+	for (i = 0; i < zone->sensor_count; i++) {
+		gathered[i] = samples[zone->sensor[i]];
+	}
+
+	int temp   = aggregate_temp(&zone->aggregation, gathered, zone->sensor_count);
+	int change = zone->primed ? temp - zone->temp : 0;
+
+	zone->speed  = curve_step(&zone->curve, zone->speed, temp, change);
+	zone->temp   = temp;
+	zone->primed = 1;
+
+	return zone->speed;
+}
+
+void zones_arbitrate(const t_zone *zones, unsigned int count, int fallback, int *speeds, unsigned int fan_count) {
+	unsigned int i;
+	unsigned int z;
+
+	for (i = 0; i < fan_count; i++) {
+		speeds[i] = -1;
+	}
+
+	for (z = 0; z < count; z++) {
+		for (i = 0; i < zones[z].fan_count; i++) {
+			unsigned int fan = zones[z].fan[i];
+
+			if (zones[z].speed > speeds[fan]) {
+				speeds[fan] = zones[z].speed;
+			}
+		}
+	}
+
+	for (i = 0; i < fan_count; i++) {
+		if (speeds[i] < 0) {
+			speeds[i] = fallback;
+		}
+	}
+}
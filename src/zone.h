@@ -0,0 +1,86 @@
+/**
+ *  Copyright (C) (2012-present) Daniel Graziotin <daniel@ineed.coffee>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _ZONE_H_
+#define _ZONE_H_
+
+#include "global.h"
+#include "aggregate.h"
+#include "curve.h"
+
+/** Upper bound for the number of zones
+ */
+#define ZONES_MAX 8
+#define ZONE_NAME_LEN 16
+#define ZONE_SPEC_LEN 256
+
+/** A group of sensors driving a group of fans along its own curve
+ */
+struct s_zone {
+	char name[ZONE_NAME_LEN];
+
+	/* comma separated labels or indexes as configured, see zone_bind() */
+	char sensors_spec[ZONE_SPEC_LEN];
+	char fans_spec[ZONE_SPEC_LEN];
+
+	/* indexes into the sensor and fan tables, resolved by zone_bind() */
+	unsigned int sensor_count;
+	unsigned int sensor[SENSORS_MAX];
+	unsigned int fan_count;
+	unsigned int fan[FANS_MAX];
+
+	t_aggregation    aggregation;
+	t_curve_triangle triangle;  // followed when points has none
+	t_curve_points   points;
+	t_curve          curve;
+
+	int temp;     // last aggregated temperature, millidegrees
+	int speed;    // speed the zone asks of its fans
+	int primed;   // FALSE until the first update
+};
+
+typedef struct s_zone t_zone;
+
+/** The zones of the [zone:NAME] sections listed by zones in [general]
+ */
+extern t_zone zones[ZONES_MAX];
+
+/**
+ * Resolve the sensor and fan selectors of a zone against the tables
+ * A selector is a label, such as TC0P, or the N of tempN_input or fanN
+ * Return FALSE if the zone selects no sensor or no fan
+ */
+int zone_bind(t_zone *zone, const t_sensors *sensors, const t_fans *fans);
+
+/**
+ * Materialize the points of a zone, or its triangle, into its curve
+ * and start it over at the triangle's min_speed
+ */
+void zone_build(t_zone *zone);
+
+/**
+ * Aggregate the samples of the zone's sensors, out of the samples
+ * of the whole sensor table, and step along the zone's curve
+ * Return the speed the zone asks of its fans
+ */
+int zone_update(t_zone *zone, const int *samples);
+
+/**
+ * Give every fan the highest speed asked by the zones holding it,
+ * fallback for the fans in no zone
+ */
+void zones_arbitrate(const t_zone *zones, unsigned int count, int fallback, int *speeds, unsigned int fan_count);
+
+#endif